@@ -35,6 +35,26 @@
 #include "motion_functions/ChFunction_Sine.h"
 #include "unit_IRRLICHT/ChIrrApp.h"
 #include "physics/ChMaterialSurface.h"
+#include "physics/ChContactContainerBase.h"
+#include "lcp/ChLcpIterativeSolver.h"
+#include "core/ChTimer.h"
+#include "Rozzi_livestream.h"
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#if defined(_WIN32)
+	#include <direct.h>
+#else
+	#include <sys/stat.h>
+#endif
+
+// Restrict qualifier for pointers to arrays that do not overlap
+#if defined(_MSC_VER) || defined(__GNUC__)
+	#define ROZZI_RESTRICT __restrict
+#else
+	#define ROZZI_RESTRICT
+#endif
 
 
 // Use the namespace of Chrono
@@ -87,21 +107,1394 @@ ChFunction* create_motion(std::string filename_pos, double t_offset = 0, double
 }
 
 
+// Load a (time, value) record, same file format parsed by create_motion(), and
+// resample it at a constant time step dt (linear interpolation). The resampled
+// values start at the first time of the file.
+
+void load_record(std::string filename, double dt, std::vector<double>& values, double factor = 1.0)
+{
+	ChStreamInAsciiFile mstream(GetChronoDataFile(filename).c_str());
+
+	std::vector<double> times;
+	std::vector<double> raw;
+
+	while(!mstream.End_of_stream())
+	{
+		double time = 0;
+		double value = 0;
+		try
+		{
+			mstream >> time;
+			mstream >> value;
+			times.push_back(time);
+			raw.push_back(value * factor);
+		}
+		catch(ChException myerror)
+		{
+			break;
+		}
+	}
+
+	values.clear();
+	if (times.size() < 2)
+		return;
+
+	int nsamples = (int)floor((times.back() - times.front()) / dt) + 1;
+	values.resize(nsamples);
+	size_t j = 0;
+	for (int i = 0; i < nsamples; i++)
+	{
+		double t = times.front() + i * dt;
+		while ((j + 2 < times.size()) && (times[j+1] < t))
+			j++;
+		double span = times[j+1] - times[j];
+		double w = (span > 0) ? (t - times[j]) / span : 0;
+		values[i] = raw[j] + w * (raw[j+1] - raw[j]);
+	}
+}
+
+
+// Ground-motion intensity measures of an acceleration record (in m/s^2).
+
+struct IntensityMeasures
+{
+	double PGA;		// peak ground acceleration [m/s^2]
+	double PGV;		// peak ground velocity [m/s]
+	double PGD;		// peak ground displacement [m]
+	double arias;	// Arias intensity pi/2g*int(a^2) [m/s]
+	double CAV;		// cumulative absolute velocity int(|a|) [m/s]
+	double a_rms;	// root mean square acceleration over the significant duration [m/s^2]
+	double t_5;		// time at 5% of Arias intensity [s]
+	double t_95;	// time at 95% of Arias intensity [s]
+	double D_5_95;	// significant duration t_95-t_5 [s]
+	double SI;		// Housner spectrum intensity, int(PSv) for T=0.1..2.5 s at 5% damping [m]
+};
+
+
+void compute_intensity_measures(const std::vector<double>& acc, double dt, IntensityMeasures& im)
+{
+	const double g = 9.81;
+
+	im.PGA = im.PGV = im.PGD = 0;
+	im.arias = im.CAV = im.a_rms = 0;
+	im.t_5 = im.t_95 = im.D_5_95 = 0;
+	im.SI = 0;
+
+	if (acc.size() < 2)
+		return;
+
+	// velocity and displacement by trapezoidal integration, no baseline correction
+	double vel = 0;
+	double disp = 0;
+	std::vector<double> husid(acc.size(), 0.0);
+	for (size_t i = 0; i < acc.size(); i++)
+	{
+		if (i > 0)
+		{
+			double vel_old = vel;
+			vel  += 0.5 * dt * (acc[i-1] + acc[i]);
+			disp += 0.5 * dt * (vel_old + vel);
+			husid[i] = husid[i-1] + 0.5 * dt * (acc[i-1]*acc[i-1] + acc[i]*acc[i]);
+			im.CAV  += 0.5 * dt * (fabs(acc[i-1]) + fabs(acc[i]));
+		}
+		im.PGA = ChMax(im.PGA, fabs(acc[i]));
+		im.PGV = ChMax(im.PGV, fabs(vel));
+		im.PGD = ChMax(im.PGD, fabs(disp));
+	}
+
+	double int_a2 = husid.back();
+	im.arias = CH_C_PI / (2 * g) * int_a2;
+	if (int_a2 <= 0)
+		return;
+
+	size_t i_5 = 0;
+	size_t i_95 = 0;
+	for (size_t i = 0; i < husid.size(); i++)
+	{
+		if (husid[i] <= 0.05 * int_a2) i_5 = i;
+		if (husid[i] <= 0.95 * int_a2) i_95 = i;
+	}
+	im.t_5 = i_5 * dt;
+	im.t_95 = i_95 * dt;
+	im.D_5_95 = im.t_95 - im.t_5;
+	if (im.D_5_95 > 0)
+		im.a_rms = sqrt(0.9 * int_a2 / im.D_5_95);
+}
+
+
+// Elastic response spectra of an acceleration record sampled at constant dt.
+// All the (period, damping) SDOF oscillators are advanced together with the
+// exact piecewise-linear recurrence of Nigam & Jennings (1969). Oscillator data
+// is stored as separate contiguous arrays, accessed through restrict pointers,
+// and the inner loop over oscillators has no branches and is marked omp simd
+// (see CMakeLists.txt for the flags), so it is vectorized also at -O2.
+// Results are stored damping-major: Sd[idamp*periods.size() + iperiod].
+
+void compute_response_spectra(const std::vector<double>& acc, double dt,
+							  const std::vector<double>& periods,
+							  const std::vector<double>& dampings,
+							  std::vector<double>& Sd,		// spectral displacement [m]
+							  std::vector<double>& PSa,		// pseudo-acceleration w^2*Sd [m/s^2]
+							  std::vector<double>& Sa)		// peak absolute acceleration [m/s^2]
+{
+	size_t nosc = periods.size() * dampings.size();
+
+	std::vector<double> a11(nosc), a12(nosc), a21(nosc), a22(nosc);
+	std::vector<double> b11(nosc), b12(nosc), b21(nosc), b22(nosc);
+	std::vector<double> k_c(nosc), k_k(nosc);
+	std::vector<double> u(nosc, 0.0), v(nosc, 0.0);
+	std::vector<double> umax(nosc, 0.0), amax(nosc, 0.0);
+
+	for (size_t id = 0; id < dampings.size(); id++)
+	{
+		for (size_t ip = 0; ip < periods.size(); ip++)
+		{
+			size_t k = id * periods.size() + ip;
+			double xi = ChMin(dampings[id], 0.99);
+			double w  = CH_C_2PI / periods[ip];
+			double r  = sqrt(1 - xi*xi);
+			double wd = w * r;
+			double E  = exp(-xi * w * dt);
+			double S  = sin(wd * dt);
+			double C  = cos(wd * dt);
+			double w2 = w * w;
+			double w3 = w2 * w;
+
+			a11[k] = E * (xi / r * S + C);
+			a12[k] = E * S / wd;
+			a21[k] = -w / r * E * S;
+			a22[k] = E * (C - xi / r * S);
+
+			double c1 = (2*xi*xi - 1) / (w2 * dt);
+			double c2 = 2 * xi / (w3 * dt);
+
+			b11[k] =  E * ((c1 + xi / w) * S / wd + (c2 + 1 / w2) * C) - c2;
+			b12[k] = -E * (c1 * S / wd + c2 * C) - 1 / w2 + c2;
+			b21[k] =  E * ((c1 + xi / w) * (C - xi / r * S) - (c2 + 1 / w2) * (wd * S + xi * w * C)) + 1 / (w2 * dt);
+			b22[k] = -E * (c1 * (C - xi / r * S) - c2 * (wd * S + xi * w * C)) - 1 / (w2 * dt);
+
+			k_c[k] = 2 * xi * w;
+			k_k[k] = w2;
+		}
+	}
+
+	// the arrays do not overlap: tell the compiler, so it needs no runtime checks
+	const double* ROZZI_RESTRICT pa11 = &a11[0];
+	const double* ROZZI_RESTRICT pa12 = &a12[0];
+	const double* ROZZI_RESTRICT pa21 = &a21[0];
+	const double* ROZZI_RESTRICT pa22 = &a22[0];
+	const double* ROZZI_RESTRICT pb11 = &b11[0];
+	const double* ROZZI_RESTRICT pb12 = &b12[0];
+	const double* ROZZI_RESTRICT pb21 = &b21[0];
+	const double* ROZZI_RESTRICT pb22 = &b22[0];
+	const double* ROZZI_RESTRICT pk_c = &k_c[0];
+	const double* ROZZI_RESTRICT pk_k = &k_k[0];
+	double* ROZZI_RESTRICT pu = &u[0];
+	double* ROZZI_RESTRICT pv = &v[0];
+	double* ROZZI_RESTRICT pumax = &umax[0];
+	double* ROZZI_RESTRICT pamax = &amax[0];
+
+	for (size_t i = 0; i + 1 < acc.size(); i++)
+	{
+		double ag0 = acc[i];
+		double ag1 = acc[i+1];
+		#pragma omp simd
+		for (size_t k = 0; k < nosc; k++)
+		{
+			double un = pa11[k] * pu[k] + pa12[k] * pv[k] + pb11[k] * ag0 + pb12[k] * ag1;
+			double vn = pa21[k] * pu[k] + pa22[k] * pv[k] + pb21[k] * ag0 + pb22[k] * ag1;
+			double an = pk_c[k] * vn + pk_k[k] * un; // absolute acceleration, sign apart
+			pu[k] = un;
+			pv[k] = vn;
+			pumax[k] = ChMax(pumax[k], fabs(un));
+			pamax[k] = ChMax(pamax[k], fabs(an));
+		}
+	}
+
+	Sd.resize(nosc);
+	PSa.resize(nosc);
+	Sa.resize(nosc);
+	for (size_t k = 0; k < nosc; k++)
+	{
+		Sd[k]  = umax[k];
+		PSa[k] = k_k[k] * umax[k];
+		Sa[k]  = amax[k];
+	}
+}
+
+
+// Housner spectrum intensity from a pseudo-acceleration spectrum at one damping
+// (trapezoidal integration of PSv = PSa*T/2pi between 0.1 and 2.5 s). In the
+// segments cut by the bounds, PSv is interpolated linearly at the bounds.
+
+double compute_spectrum_intensity(const std::vector<double>& periods, const double* PSa)
+{
+	double SI = 0;
+	for (size_t ip = 1; ip < periods.size(); ip++)
+	{
+		double Ta = periods[ip-1];
+		double Tb = periods[ip];
+		double T0 = ChMax(Ta, 0.1);
+		double T1 = ChMin(Tb, 2.5);
+		if (T1 <= T0 || Tb <= Ta)
+			continue;
+		double psva = PSa[ip-1] * Ta / CH_C_2PI;
+		double psvb = PSa[ip]   * Tb / CH_C_2PI;
+		double psv0 = psva + (psvb - psva) * (T0 - Ta) / (Tb - Ta);
+		double psv1 = psva + (psvb - psva) * (T1 - Ta) / (Tb - Ta);
+		SI += 0.5 * (psv0 + psv1) * (T1 - T0);
+	}
+	return SI;
+}
+
+
+// Per-step reporter of contact forces, aggregated on a few tracked bodies or
+// body pairs. It is used as a callback of ChContactContainerBase::ReportAllContacts();
+// all sums are reduced in place in the channels, so there is no allocation per
+// contact. The convention is that the reaction plane_coord*react_forces is the
+// force applied to body B, and the opposite one is applied to body A.
+// Powers use the mean of the speeds before and after the step: with the
+// velocity-level stepper the change of kinetic energy in a step is the impulse
+// times the mean speed, so impact losses end in the dissipated energy and not
+// in the drift. The speeds before the step are stored in preallocated arrays.
+
+class ContactRecorder : public ChReportContactCallback
+{
+public:
+	struct Channel
+	{
+		ChBody* body_a;			// tracked body
+		ChBody* body_b;			// other body of the pair, or 0 for contacts with any body
+
+		int n_contacts;			// contacts in the last step
+		ChVector<> F;			// total contact force on body_a in the last step [N]
+		double Fn;				// sum of normal forces in the last step [N]
+		double Ft;				// sum of tangential forces in the last step [N]
+		double P_friction;		// power dissipated by friction in the last step [W]
+
+		double impulse_n;		// normal impulse since the last ResetOutput() [N s]
+		double impulse_t;		// tangential impulse since the last ResetOutput() [N s]
+		double Fn_peak;			// peak of Fn since the last ResetOutput() [N]
+		double friction_work;	// work dissipated by friction since the start [J]
+	};
+
+	ContactRecorder() : step_dissipation(0), step_friction_power(0), dissipated(0), friction_work(0) {}
+
+		/// Track all the contacts of a body (mbody_b = 0) or the contacts between two bodies.
+		/// Returns the index of the channel.
+	int AddChannel(ChBody* mbody_a, ChBody* mbody_b = 0)
+	{
+		Channel mchannel;
+		mchannel.body_a = mbody_a;
+		mchannel.body_b = mbody_b;
+		mchannel.F = VNULL;
+		mchannel.n_contacts = 0;
+		mchannel.Fn = mchannel.Ft = mchannel.P_friction = 0;
+		mchannel.impulse_n = mchannel.impulse_t = mchannel.Fn_peak = 0;
+		mchannel.friction_work = 0;
+		channels.push_back(mchannel);
+		return (int)channels.size() - 1;
+	}
+
+	Channel& GetChannel(int i) { return channels[i]; }
+	int GetNchannels() { return (int)channels.size(); }
+
+		/// Store position and speeds of all the bodies; call just before each step.
+	void StoreSpeeds(ChSystem& msystem)
+	{
+		int nbodies = 0;
+		for (ChSystem::IteratorBodies ibody = msystem.IterBeginBodies(); ibody != msystem.IterEndBodies(); ++ibody)
+			nbodies++;
+		if (nbodies != (int)body_index.size())
+		{
+			// bodies added or removed: rebuild the lookup table, sorted by address
+			body_index.clear();
+			int i = 0;
+			for (ChSystem::IteratorBodies ibody = msystem.IterBeginBodies(); ibody != msystem.IterEndBodies(); ++ibody, ++i)
+				body_index.push_back(std::make_pair(&(**ibody), i));
+			std::sort(body_index.begin(), body_index.end());
+			pre_pos.resize(nbodies);
+			pre_v.resize(nbodies);
+			pre_w.resize(nbodies);
+		}
+		int i = 0;
+		for (ChSystem::IteratorBodies ibody = msystem.IterBeginBodies(); ibody != msystem.IterEndBodies(); ++ibody, ++i)
+		{
+			pre_pos[i] = (*ibody)->GetPos();
+			pre_v[i] = (*ibody)->GetPos_dt();
+			pre_w[i] = (*ibody)->GetWvel_par();
+		}
+	}
+
+		/// Mean of the speeds of a body before and after the last step.
+	ChVector<> GetMeanSpeed(ChBody* mbody)
+	{
+		int i = FindBody(mbody);
+		if (i < 0)
+			return mbody->GetPos_dt();
+		return (pre_v[i] + mbody->GetPos_dt()) * 0.5;
+	}
+
+		/// Mean of the speeds before and after the last step of the point of a body
+		/// that was at the absolute position point at the start of the step.
+	ChVector<> GetMeanPointSpeed(ChBody* mbody, const ChVector<>& point)
+	{
+		int i = FindBody(mbody);
+		if (i < 0)
+			return mbody->PointSpeedLocalToParent(mbody->TransformParentToLocal(point));
+		ChVector<> v = (pre_v[i] + mbody->GetPos_dt()) * 0.5;
+		ChVector<> w = (pre_w[i] + mbody->GetWvel_par()) * 0.5;
+		return v + Vcross(w, point - pre_pos[i]);
+	}
+
+		/// Energy dissipated by all contacts (friction and normal compliance/damping) since the start.
+	double GetDissipated() { return dissipated; }
+		/// Part of GetDissipated() due to the tangential forces.
+	double GetFrictionWork() { return friction_work; }
+
+	void BeginStep()
+	{
+		for (size_t i = 0; i < channels.size(); i++)
+		{
+			channels[i].n_contacts = 0;
+			channels[i].F = VNULL;
+			channels[i].Fn = 0;
+			channels[i].Ft = 0;
+			channels[i].P_friction = 0;
+		}
+		step_dissipation = 0;
+		step_friction_power = 0;
+	}
+
+	void EndStep(double dt)
+	{
+		for (size_t i = 0; i < channels.size(); i++)
+		{
+			channels[i].impulse_n += channels[i].Fn * dt;
+			channels[i].impulse_t += channels[i].Ft * dt;
+			channels[i].Fn_peak = ChMax(channels[i].Fn_peak, channels[i].Fn);
+			channels[i].friction_work += channels[i].P_friction * dt;
+		}
+		dissipated += step_dissipation * dt;
+		friction_work += step_friction_power * dt;
+	}
+
+		/// Call after saving the channels, to restart impulses and peaks.
+	void ResetOutput()
+	{
+		for (size_t i = 0; i < channels.size(); i++)
+		{
+			channels[i].impulse_n = 0;
+			channels[i].impulse_t = 0;
+			channels[i].Fn_peak = 0;
+		}
+	}
+
+	virtual bool ReportContactCallback(const ChVector<>& pA,
+									   const ChVector<>& pB,
+									   const ChMatrix33<>& plane_coord,
+									   const double& distance,
+									   const float& mfriction,
+									   const ChVector<>& react_forces,
+									   const ChVector<>& react_torques,
+									   collision::ChCollisionModel* modA,
+									   collision::ChCollisionModel* modB)
+	{
+		ChBody* bodyA = dynamic_cast<ChBody*>(modA->GetPhysicsItem());
+		ChBody* bodyB = dynamic_cast<ChBody*>(modB->GetPhysicsItem());
+		if (!bodyA || !bodyB)
+			return true;
+
+		// force on B in absolute coordinates, and its normal/tangential parts
+		ChVector<> F = plane_coord.Matr_x_Vect(react_forces);
+		ChVector<> normal = plane_coord.Get_A_Xaxis();
+		double Fn = react_forces.x;
+		ChVector<> Ft = F - normal * Fn;
+
+		// mean relative speed of B respect to A at the contact, and the power lost
+		ChVector<> vA = GetMeanPointSpeed(bodyA, pA);
+		ChVector<> vB = GetMeanPointSpeed(bodyB, pB);
+		ChVector<> v_rel = vB - vA;
+		double friction_power = -Vdot(Ft, v_rel);
+		step_dissipation += -Vdot(F, v_rel);
+		step_friction_power += friction_power;
+
+		for (size_t i = 0; i < channels.size(); i++)
+		{
+			Channel& mchannel = channels[i];
+			double sign = 0;
+			if (mchannel.body_a == bodyA && (!mchannel.body_b || mchannel.body_b == bodyB))
+				sign = -1;
+			else if (mchannel.body_a == bodyB && (!mchannel.body_b || mchannel.body_b == bodyA))
+				sign = 1;
+			else
+				continue;
+
+			mchannel.n_contacts++;
+			mchannel.F += F * sign;
+			mchannel.Fn += fabs(Fn);
+			mchannel.Ft += Ft.Length();
+			mchannel.P_friction += friction_power;
+		}
+
+		return true; // continue scanning contacts
+	}
+
+private:
+		/// Index of a body in the stored speeds, -1 if not stored.
+	int FindBody(ChBody* mbody)
+	{
+		std::vector<std::pair<ChBody*, int> >::iterator it =
+			std::lower_bound(body_index.begin(), body_index.end(), std::make_pair(mbody, -1));
+		if (it == body_index.end() || it->first != mbody)
+			return -1;
+		return it->second;
+	}
+
+	std::vector<Channel> channels;
+	std::vector<std::pair<ChBody*, int> > body_index;	// bodies sorted by address, and their index
+	std::vector<ChVector<> > pre_pos;	// position of the bodies before the step
+	std::vector<ChVector<> > pre_v;		// speed before the step
+	std::vector<ChVector<> > pre_w;		// angular speed before the step, absolute
+	double step_dissipation;
+	double step_friction_power;
+	double dissipated;
+	double friction_work;
+};
+
+
+// Kinetic and gravitational potential energy of all the free bodies, that is not
+// fixed and not the driven body (the table, whose motion is prescribed).
+// Rotational energy uses the diagonal inertia, exact for the boxes of this model.
+
+void compute_mechanical_energy(ChSystem& msystem, double& kinetic, double& potential, ChBody* driven = 0)
+{
+	kinetic = 0;
+	potential = 0;
+	ChVector<> G = msystem.Get_G_acc();
+
+	ChSystem::IteratorBodies ibody = msystem.IterBeginBodies();
+	while (ibody != msystem.IterEndBodies())
+	{
+		if (!(*ibody)->GetBodyFixed() && &(**ibody) != driven)
+		{
+			double m = (*ibody)->GetMass();
+			ChVector<> v = (*ibody)->GetPos_dt();
+			ChVector<> w = (*ibody)->GetWvel_loc();
+			ChVector<> J = (*ibody)->GetInertiaXX();
+			kinetic += 0.5 * m * Vdot(v, v) + 0.5 * (J.x * w.x * w.x + J.y * w.y * w.y + J.z * w.z * w.z);
+			potential += -m * Vdot(G, (*ibody)->GetPos());
+		}
+		++ibody;
+	}
+}
+
+
+// Content-addressed cache of the results. Each run is identified by a hash of
+// a text description of all its inputs; its output files are stored in
+// result_cache/<hash>/ and, if the same case is run again, they are copied
+// back instead of being recomputed.
+
+unsigned long long hash_fnv1a(const std::string& data)
+{
+	unsigned long long h = 14695981039346656037ULL;	// 64 bit FNV-1a
+	for (size_t i = 0; i < data.size(); i++)
+	{
+		h ^= (unsigned char)data[i];
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+
+bool read_file_contents(const std::string& filename, std::string& contents)
+{
+	std::ifstream mfile(filename.c_str(), std::ios::in | std::ios::binary);
+	if (!mfile)
+		return false;
+	std::ostringstream mbuffer;
+	mbuffer << mfile.rdbuf();
+	contents = mbuffer.str();
+	return true;
+}
+
+
+// Contents of the running executable: results of different builds must never
+// be mixed in the cache, as a new build may change what the outputs mean.
+
+bool read_executable_contents(std::string& contents)
+{
+#if defined(_WIN32)
+	char mpath[MAX_PATH];
+	DWORD nchars = GetModuleFileNameA(NULL, mpath, MAX_PATH);
+	if (nchars == 0 || nchars >= MAX_PATH)
+		return false;
+	return read_file_contents(mpath, contents);
+#else
+	return read_file_contents("/proc/self/exe", contents);	// Linux; elsewhere only the build date is used
+#endif
+}
+
+
+// Path of an output file in the output directory of the run ("" for the
+// current directory).
+
+std::string output_path(const std::string& output_dir, const std::string& filename)
+{
+	if (output_dir == "")
+		return filename;
+	return output_dir + "/" + filename;
+}
+
+
+bool copy_file(const std::string& source, const std::string& dest)
+{
+	std::ifstream msource(source.c_str(), std::ios::in | std::ios::binary);
+	if (!msource)
+		return false;
+	std::ofstream mdest(dest.c_str(), std::ios::out | std::ios::binary);
+	if (!mdest)
+		return false;
+	mdest << msource.rdbuf();
+	return mdest.good();
+}
+
+
+void make_directory(const std::string& path)
+{
+#if defined(_WIN32)
+	_mkdir(path.c_str());
+#else
+	mkdir(path.c_str(), 0755);
+#endif
+}
+
+
+// Describe the system as it has been built: for each body its mass, inertia,
+// initial state and contact material, plus the global and solver settings.
+
+void describe_system(ChSystem& msystem, std::ostream& key)
+{
+	key << "G " << msystem.Get_G_acc().x << " " << msystem.Get_G_acc().y << " " << msystem.Get_G_acc().z << "\n";
+	key << "lcp_solver " << (int)msystem.GetLcpSolverType() << "\n";
+	key << "lcp_iters_speed " << msystem.GetIterLCPmaxItersSpeed() << "\n";
+	key << "lcp_iters_stab " << msystem.GetIterLCPmaxItersStab() << "\n";
+	key << "integration " << (int)msystem.GetIntegrationType() << "\n";
+	key << "warm_start " << msystem.GetIterLCPwarmStarting() << "\n";
+	key << "tol " << msystem.GetTol() << " tol_force " << msystem.GetTolForce() << "\n";
+	key << "max_penetration_recovery_speed " << msystem.GetMaxPenetrationRecoverySpeed() << "\n";
+	key << "min_bounce_speed " << msystem.GetMinBounceSpeed() << "\n";
+	key << "sleeping " << msystem.GetUseSleeping() << "\n";
+	key << "time " << msystem.GetChTime() << "\n";
+	key << "envelope " << ChCollisionModel::GetDefaultSuggestedEnvelope() << "\n";
+	key << "margin " << ChCollisionModel::GetDefaultSuggestedMargin() << "\n";
+
+	ChSystem::IteratorBodies ibody = msystem.IterBeginBodies();
+	while (ibody != msystem.IterEndBodies())
+	{
+		ChVector<> pos = (*ibody)->GetPos();
+		ChQuaternion<> rot = (*ibody)->GetRot();
+		ChVector<> pos_dt = (*ibody)->GetPos_dt();
+		ChVector<> wvel = (*ibody)->GetWvel_loc();
+		ChVector<> J = (*ibody)->GetInertiaXX();
+		key << "body"
+			<< " fixed " << (*ibody)->GetBodyFixed()
+			<< " collide " << (*ibody)->GetCollide()
+			<< " mass " << (*ibody)->GetMass()
+			<< " J " << J.x << " " << J.y << " " << J.z
+			<< " pos " << pos.x << " " << pos.y << " " << pos.z
+			<< " rot " << rot.e0 << " " << rot.e1 << " " << rot.e2 << " " << rot.e3
+			<< " pos_dt " << pos_dt.x << " " << pos_dt.y << " " << pos_dt.z
+			<< " wvel " << wvel.x << " " << wvel.y << " " << wvel.z;
+		ChSharedPtr<ChMaterialSurface> mmat = (*ibody)->GetMaterialSurface();
+		key << " friction " << mmat->GetSfriction() << " " << mmat->GetKfriction()
+			<< " compliance " << mmat->GetCompliance() << " " << mmat->GetComplianceT()
+			<< " dampingf " << mmat->GetDampingF()
+			<< " restitution " << mmat->GetRestitution()
+			<< " rolling " << mmat->GetRollingFriction()
+			<< " spinning " << mmat->GetSpinningFriction() << "\n";
+		++ibody;
+	}
+}
+
+
+// Synthetic ground motions, generated in memory. All of them are functions of
+// time returning the displacement of the table, with consistent first and
+// second derivatives (velocity and acceleration), so they can be used directly
+// in SetMotion_X() etc. The amplitude is always a peak ground acceleration in
+// m/s^2 and t0 is the onset time: before t0 the table is at rest (the
+// wavelets, which have no sharp start, are delayed so that displacement,
+// velocity and acceleration at t0 are below 1e-6 of their peaks).
+
+
+// Ricker wavelet of acceleration, a = A*(1-2u)*exp(-u) with u = (pi*f*(t-tc))^2,
+// centered at tc = t0 + 1.5/f. Velocity and displacement are its exact
+// integrals, both zero at the end.
+
+class ChFunction_Ricker : public ChFunction
+{
+public:
+	ChFunction_Ricker(double mampl = 0, double mfreq = 1, double mt0 = 0) : ampl(mampl), freq(mfreq), tc(mt0 + 1.5 / mfreq) {}
+
+	virtual ChFunction* new_Duplicate() { return new ChFunction_Ricker(*this); }
+	virtual int Get_Type() { return FUNCT_CUSTOM; }
+
+	virtual double Get_y(double x)		{ double k = CH_C_PI * freq; double tau = x - tc; return -ampl * exp(-k*k*tau*tau) / (2*k*k); }
+	virtual double Get_y_dx(double x)	{ double k = CH_C_PI * freq; double tau = x - tc; return ampl * tau * exp(-k*k*tau*tau); }
+	virtual double Get_y_dxdx(double x)	{ double k = CH_C_PI * freq; double u = k*k*(x - tc)*(x - tc); return ampl * (1 - 2*u) * exp(-u); }
+
+private:
+	double ampl, freq, tc;
+};
+
+
+// Gabor wavelet, a harmonic with gaussian envelope, defined on the displacement
+// d = D * exp(-(w*(t-tc)/gamma)^2) * cos(w*(t-tc) + phase), w = 2*pi*f, and
+// differentiated analytically. It is centered at tc = t0 + 4*gamma/w, where the
+// envelope at t0 is exp(-16). D is scaled so that the peak acceleration is A:
+// with D = A/w^2 the peak would be about 1.22*A for gamma = 3.
+
+class ChFunction_Gabor : public ChFunction
+{
+public:
+	ChFunction_Gabor(double mampl = 0, double mfreq = 1, double mt0 = 0, double mgamma = 3, double mphase = 0)
+		: freq(mfreq), gamma(mgamma), phase(mphase), D(1)
+	{
+		double w = CH_C_2PI * freq;
+		tc = mt0 + 4 * gamma / w;
+
+		// peak of the acceleration with D = 1, sampled over the whole wavelet
+		double peak = 0;
+		int nsamples = 2000;
+		for (int i = 0; i <= nsamples; i++)
+			peak = ChMax(peak, fabs(Eval(mt0 + i * (8 * gamma / w) / nsamples, 2)));
+		D = (peak > 0) ? mampl / peak : 0;
+	}
+
+	virtual ChFunction* new_Duplicate() { return new ChFunction_Gabor(*this); }
+	virtual int Get_Type() { return FUNCT_CUSTOM; }
+
+	virtual double Get_y(double x)		{ return Eval(x, 0); }
+	virtual double Get_y_dx(double x)	{ return Eval(x, 1); }
+	virtual double Get_y_dxdx(double x)	{ return Eval(x, 2); }
+
+private:
+	double Eval(double x, int der)
+	{
+		double w = CH_C_2PI * freq;
+		double k = w / gamma;
+		double tau = x - tc;
+		double g = exp(-k*k*tau*tau);			// envelope and its derivatives
+		double g1 = -2 * k*k * tau * g;
+		double g2 = (4 * k*k*k*k * tau*tau - 2 * k*k) * g;
+		double c = cos(w * tau + phase);
+		double s = sin(w * tau + phase);
+		if (der == 0) return D * g * c;
+		if (der == 1) return D * (g1 * c - w * g * s);
+		return D * (g2 * c - 2 * w * g1 * s - w * w * g * c);
+	}
+
+	double freq, tc, gamma, phase, D;
+};
+
+
+// One-sine pulse of acceleration, a = A*sin(w*(t-t0)) for one period 1/f.
+// Velocity is zero at the end, the displacement keeps a permanent offset A/(w*f).
+
+class ChFunction_SinePulse : public ChFunction
+{
+public:
+	ChFunction_SinePulse(double mampl = 0, double mfreq = 1, double mt0 = 0) : ampl(mampl), freq(mfreq), t0(mt0) {}
+
+	virtual ChFunction* new_Duplicate() { return new ChFunction_SinePulse(*this); }
+	virtual int Get_Type() { return FUNCT_CUSTOM; }
+
+	virtual double Get_y(double x)		{ double w = CH_C_2PI * freq; double tau = Clamp(x); return ampl / w * (tau - sin(w * tau) / w); }
+	virtual double Get_y_dx(double x)	{ double w = CH_C_2PI * freq; double tau = Clamp(x); return ampl / w * (1 - cos(w * tau)); }
+	virtual double Get_y_dxdx(double x)	{ double w = CH_C_2PI * freq; double tau = Clamp(x); return ampl * sin(w * tau); }
+
+private:
+	double Clamp(double x) { return ChMax(0.0, ChMin(x - t0, 1.0 / freq)); }
+
+	double ampl, freq, t0;
+};
+
+
+// One-cosine pulse of acceleration, a = A*cos(w*(t-t0)) for one period 1/f.
+// Both velocity and displacement are back to zero at the end.
+
+class ChFunction_CosinePulse : public ChFunction
+{
+public:
+	ChFunction_CosinePulse(double mampl = 0, double mfreq = 1, double mt0 = 0) : ampl(mampl), freq(mfreq), t0(mt0) {}
+
+	virtual ChFunction* new_Duplicate() { return new ChFunction_CosinePulse(*this); }
+	virtual int Get_Type() { return FUNCT_CUSTOM; }
+
+	virtual double Get_y(double x)		{ double w = CH_C_2PI * freq; double tau = Clamp(x); return ampl / (w * w) * (1 - cos(w * tau)); }
+	virtual double Get_y_dx(double x)	{ double w = CH_C_2PI * freq; double tau = Clamp(x); return ampl / w * sin(w * tau); }
+	virtual double Get_y_dxdx(double x)
+	{
+		double tau = x - t0;
+		if (tau < 0 || tau > 1.0 / freq)
+			return 0;
+		return ampl * cos(CH_C_2PI * freq * tau);
+	}
+
+private:
+	double Clamp(double x) { return ChMax(0.0, ChMin(x - t0, 1.0 / freq)); }
+
+	double ampl, freq, t0;
+};
+
+
+// Motion given by acceleration samples at constant dt, linear between samples.
+// Velocity and displacement are the exact integrals of the piecewise-linear
+// acceleration (quadratic and cubic in each interval), so the three are
+// consistent. Before the first sample the motion is at rest, after the last one
+// it stays at the final displacement.
+
+class ChFunction_SampledMotion : public ChFunction
+{
+public:
+	ChFunction_SampledMotion() : t_start(0), dt(1) {}
+
+	void SetAcceleration(double mt_start, double mdt, const std::vector<double>& macc)
+	{
+		t_start = mt_start;
+		dt = mdt;
+		acc = macc;
+		vel.assign(acc.size(), 0.0);
+		disp.assign(acc.size(), 0.0);
+		for (size_t i = 1; i < acc.size(); i++)
+		{
+			vel[i]  = vel[i-1] + dt * (acc[i-1] + acc[i]) / 2;
+			disp[i] = disp[i-1] + vel[i-1] * dt + dt * dt * (2 * acc[i-1] + acc[i]) / 6;
+		}
+	}
+
+	virtual ChFunction* new_Duplicate() { return new ChFunction_SampledMotion(*this); }
+	virtual int Get_Type() { return FUNCT_CUSTOM; }
+
+	virtual double Get_y(double x)		{ return Eval(x, 0); }
+	virtual double Get_y_dx(double x)	{ return Eval(x, 1); }
+	virtual double Get_y_dxdx(double x)	{ return Eval(x, 2); }
+
+private:
+	double Eval(double x, int der)
+	{
+		if (acc.size() < 2 || x <= t_start)
+			return 0;
+		size_t i = (size_t)((x - t_start) / dt);
+		if (i >= acc.size() - 1)
+			return (der == 0) ? disp.back() : 0;
+		double tau = x - t_start - i * dt;
+		double slope = (acc[i+1] - acc[i]) / dt;
+		if (der == 0) return disp[i] + vel[i] * tau + acc[i] * tau*tau / 2 + slope * tau*tau*tau / 6;
+		if (der == 1) return vel[i] + acc[i] * tau + slope * tau*tau / 2;
+		return acc[i] + slope * tau;
+	}
+
+	double t_start, dt;
+	std::vector<double> acc, vel, disp;
+};
+
+
+// Baseline correction of acceleration samples: subtracts a half-sine and a
+// full-sine window, both zero at the ends, so that the final velocity and the
+// final displacement (as integrated by ChFunction_SampledMotion) are zero.
+
+void baseline_correct(std::vector<double>& acc, double dt)
+{
+	size_t n = acc.size();
+	if (n < 3)
+		return;
+	double T = (n - 1) * dt;
+
+	std::vector<double> w1(n), w2(n);
+	for (size_t i = 0; i < n; i++)
+	{
+		w1[i] = sin(CH_C_PI * i * dt / T);
+		w2[i] = sin(CH_C_2PI * i * dt / T);
+	}
+
+	// final velocity and displacement of a sampled acceleration
+	double V[3], D[3];
+	std::vector<double>* signals[3] = {&acc, &w1, &w2};
+	for (int k = 0; k < 3; k++)
+	{
+		std::vector<double>& a = *signals[k];
+		double v = 0, d = 0;
+		for (size_t i = 1; i < n; i++)
+		{
+			d += v * dt + dt * dt * (2 * a[i-1] + a[i]) / 6;
+			v += dt * (a[i-1] + a[i]) / 2;
+		}
+		V[k] = v;
+		D[k] = d;
+	}
+
+	// solve [V1 V2; D1 D2] [alpha; beta] = [V0; D0]
+	double det = V[1] * D[2] - V[2] * D[1];
+	if (fabs(det) < 1e-30)
+		return;
+	double alpha = (V[0] * D[2] - V[2] * D[0]) / det;
+	double beta  = (V[1] * D[0] - V[0] * D[1]) / det;
+	for (size_t i = 0; i < n; i++)
+		acc[i] -= alpha * w1[i] + beta * w2[i];
+}
+
+
+// Swept sine of acceleration, frequency linearly from f0 to f1 in the given
+// duration, with 10% cosine tapers at both ends, baseline corrected. The
+// sampling step is 0.002 s, reduced to have at least 20 samples per period of
+// f1 (no aliasing of the top of the sweep), unless given.
+
+ChFunction* create_swept_sine(double ampl, double f0, double f1, double t0, double duration, double dt = 0)
+{
+	if (dt <= 0)
+		dt = ChMin(0.002, 1.0 / (20 * ChMax(f0, f1)));
+	int n = (int)(duration / dt) + 1;
+	std::vector<double> acc(n);
+	double t_taper = 0.1 * duration;
+	for (int i = 0; i < n; i++)
+	{
+		double tau = i * dt;
+		double phase = CH_C_2PI * (f0 * tau + (f1 - f0) * tau * tau / (2 * duration));
+		double taper = 1;
+		if (tau < t_taper)
+			taper = 0.5 * (1 - cos(CH_C_PI * tau / t_taper));
+		if (tau > duration - t_taper)
+			taper = 0.5 * (1 - cos(CH_C_PI * (duration - tau) / t_taper));
+		acc[i] = ampl * taper * sin(phase);
+	}
+	baseline_correct(acc, dt);
+
+	ChFunction_SampledMotion* mmotion = new ChFunction_SampledMotion;
+	mmotion->SetAcceleration(t0, dt, acc);
+	return mmotion;
+}
+
+
+// Elastic response spectrum of Eurocode 8, type 1, ground type B, 5% damping
+// (pseudo-acceleration in m/s^2 for peak ground acceleration ag on rock).
+
+double ec8_spectrum(double T, double ag)
+{
+	double S = 1.2, TB = 0.15, TC = 0.5, TD = 2.0;
+	if (T <= TB) return ag * S * (1 + T / TB * 1.5);
+	if (T <= TC) return ag * S * 2.5;
+	if (T <= TD) return ag * S * 2.5 * TC / T;
+	return ag * S * 2.5 * TC * TD / (T * T);
+}
+
+
+// Stochastic acceleration record compatible with a target pseudo-acceleration
+// spectrum at 5% damping: a sum of harmonics with random phases under a
+// build-up, strong-motion and decay envelope. The amplitudes of the harmonics
+// are corrected iteratively with the ratio between target and computed spectrum
+// at their periods, then the record is baseline corrected. The same seed
+// always gives the same record.
+
+ChFunction* create_stochastic_motion(const std::vector<double>& target_periods,
+									 const std::vector<double>& target_PSa,
+									 double t0, double duration,
+									 unsigned int seed = 1,
+									 int iterations = 8,
+									 double dt = 0.005)
+{
+	size_t nfreq = target_periods.size();
+	int n = (int)(duration / dt) + 1;
+
+	// random phases, with a small xorshift generator so records are the same on all platforms
+	unsigned int rnd = seed ? seed : 1;
+	std::vector<double> omega(nfreq), phase(nfreq), amplitude(nfreq);
+	for (size_t k = 0; k < nfreq; k++)
+	{
+		rnd ^= rnd << 13;
+		rnd ^= rnd >> 17;
+		rnd ^= rnd << 5;
+		omega[k] = CH_C_2PI / target_periods[k];
+		phase[k] = CH_C_2PI * (rnd / 4294967296.0);
+		amplitude[k] = target_PSa[k] / sqrt((double)nfreq);
+	}
+
+	std::vector<double> envelope(n);
+	double t1 = 0.1 * duration, t2 = 0.5 * duration;
+	double c = -log(0.05) / (duration - t2);
+	for (int i = 0; i < n; i++)
+	{
+		double tau = i * dt;
+		if (tau < t1)		envelope[i] = (tau / t1) * (tau / t1);
+		else if (tau < t2)	envelope[i] = 1;
+		else				envelope[i] = exp(-c * (tau - t2));
+	}
+
+	std::vector<double> acc(n);
+	std::vector<double> dampings(1, 0.05);
+	std::vector<double> Sd, PSa, Sa;
+	for (int iter = 0; iter <= iterations; iter++)
+	{
+		for (int i = 0; i < n; i++)
+		{
+			double sum = 0;
+			for (size_t k = 0; k < nfreq; k++)
+				sum += amplitude[k] * sin(omega[k] * i * dt + phase[k]);
+			acc[i] = envelope[i] * sum;
+		}
+		if (iter == iterations)
+			break;
+		compute_response_spectra(acc, dt, target_periods, dampings, Sd, PSa, Sa);
+		for (size_t k = 0; k < nfreq; k++)
+			if (PSa[k] > 0)
+				amplitude[k] *= target_PSa[k] / PSa[k];
+	}
+	baseline_correct(acc, dt);
+
+	ChFunction_SampledMotion* mmotion = new ChFunction_SampledMotion;
+	mmotion->SetAcceleration(t0, dt, acc);
+	return mmotion;
+}
+
+
+// Create the motion of the table by name, as chosen with the -motion option:
+// ricker, gabor, sine_pulse, cosine_pulse, sweep (freq to 10*freq) or
+// stochastic (Eurocode 8 spectrum with ag = ampl). Returns 0 if the name is not
+// known.
+
+ChFunction* create_synthetic_motion(std::string type, double ampl, double freq, double t0, double duration, unsigned int seed)
+{
+	if (type == "ricker")
+		return new ChFunction_Ricker(ampl, freq, t0);
+	if (type == "gabor")
+		return new ChFunction_Gabor(ampl, freq, t0);
+	if (type == "sine_pulse")
+		return new ChFunction_SinePulse(ampl, freq, t0);
+	if (type == "cosine_pulse")
+		return new ChFunction_CosinePulse(ampl, freq, t0);
+	if (type == "sweep")
+		return create_swept_sine(ampl, freq, 10 * freq, t0, duration);
+	if (type == "stochastic")
+	{
+		std::vector<double> periods, target;
+		int n_periods = 100;
+		for (int ip = 0; ip < n_periods; ip++)
+		{
+			periods.push_back(0.04 * pow(4.0/0.04, (double)ip/(n_periods-1))); // log spaced, 0.04..4 s
+			target.push_back(ec8_spectrum(periods.back(), ampl));
+		}
+		return create_stochastic_motion(periods, target, t0, duration, seed);
+	}
+	return 0;
+}
+
+
+// Save and load the state of all the bodies (position, rotation, speeds) and
+// the time, to start a run from the settled configuration of a reference run
+// instead of repeating the settlement of the blocks. Bodies are matched by
+// their order in the system, so the two runs must build the same scene: the
+// number of bodies and the mass of each body are stored in the file and
+// checked on load. A state saved after max_time (the onset of the motion of
+// the new run) is refused, as the run would start partway through the motion.
+
+bool save_system_state(ChSystem& msystem, std::string filename)
+{
+	try
+	{
+		ChStreamOutAsciiFile mstream(filename.c_str());
+		mstream.SetNumFormat("%.17g");	// full precision, to restart exactly
+		mstream << msystem.GetChTime() << "\n";
+		int nbodies = 0;
+		for (ChSystem::IteratorBodies ibody = msystem.IterBeginBodies(); ibody != msystem.IterEndBodies(); ++ibody)
+			nbodies++;
+		mstream << nbodies << "\n";
+		ChSystem::IteratorBodies ibody = msystem.IterBeginBodies();
+		while (ibody != msystem.IterEndBodies())
+		{
+			ChVector<> pos = (*ibody)->GetPos();
+			ChQuaternion<> rot = (*ibody)->GetRot();
+			ChVector<> pos_dt = (*ibody)->GetPos_dt();
+			ChVector<> wvel = (*ibody)->GetWvel_loc();
+			mstream << (*ibody)->GetMass() << " "
+					<< pos.x << " " << pos.y << " " << pos.z << " "
+					<< rot.e0 << " " << rot.e1 << " " << rot.e2 << " " << rot.e3 << " "
+					<< pos_dt.x << " " << pos_dt.y << " " << pos_dt.z << " "
+					<< wvel.x << " " << wvel.y << " " << wvel.z << "\n";
+			++ibody;
+		}
+	}
+	catch(ChException myerror)
+	{
+		GetLog() << "  Cannot save state in " << filename.c_str() << " because: \n  " << myerror.what() << "\n";
+		return false;
+	}
+	return true;
+}
+
+
+bool load_system_state(ChSystem& msystem, std::string filename, double max_time)
+{
+	// Read everything first, and set the bodies only if the file matches the
+	// scene: a failed load must not leave the system half seeded.
+	std::ifstream mstream(filename.c_str());
+	double time = 0;
+	int nbodies = 0;
+	if (!(mstream >> time >> nbodies))
+	{
+		GetLog() << "  Cannot load state from " << filename.c_str() << ": not a state file\n";
+		return false;
+	}
+	if (time > max_time)
+	{
+		GetLog() << "  Cannot load state from " << filename.c_str() << ": it was saved at t = " << time
+				 << " s, after the onset of the motion at t = " << max_time << " s\n";
+		return false;
+	}
+
+	int nbodies_system = 0;
+	for (ChSystem::IteratorBodies ibody = msystem.IterBeginBodies(); ibody != msystem.IterEndBodies(); ++ibody)
+		nbodies_system++;
+	if (nbodies != nbodies_system)
+	{
+		GetLog() << "  Cannot load state from " << filename.c_str() << ": it has " << nbodies
+				 << " bodies, the system has " << nbodies_system << "\n";
+		return false;
+	}
+
+	std::vector<double> mass(nbodies);
+	std::vector<ChVector<> > pos(nbodies), pos_dt(nbodies), wvel(nbodies);
+	std::vector<ChQuaternion<> > rot(nbodies);
+	for (int i = 0; i < nbodies; i++)
+	{
+		mstream >> mass[i];
+		mstream >> pos[i].x >> pos[i].y >> pos[i].z;
+		mstream >> rot[i].e0 >> rot[i].e1 >> rot[i].e2 >> rot[i].e3;
+		mstream >> pos_dt[i].x >> pos_dt[i].y >> pos_dt[i].z;
+		mstream >> wvel[i].x >> wvel[i].y >> wvel[i].z;
+	}
+	if (!mstream)
+	{
+		GetLog() << "  Cannot load state from " << filename.c_str() << ": file truncated or not readable\n";
+		return false;
+	}
+	mstream >> std::ws;
+	if (!mstream.eof())
+	{
+		GetLog() << "  Cannot load state from " << filename.c_str() << ": unexpected data after the last body\n";
+		return false;
+	}
+
+	int i = 0;
+	for (ChSystem::IteratorBodies ibody = msystem.IterBeginBodies(); ibody != msystem.IterEndBodies(); ++ibody, ++i)
+	{
+		double msystem_mass = (*ibody)->GetMass();
+		if (fabs(mass[i] - msystem_mass) > 1e-9 * ChMax(fabs(msystem_mass), 1.0))
+		{
+			GetLog() << "  Cannot load state from " << filename.c_str() << ": body " << i << " has mass "
+					 << mass[i] << ", in the system " << msystem_mass << " (not the same scene)\n";
+			return false;
+		}
+	}
+
+	i = 0;
+	for (ChSystem::IteratorBodies ibody = msystem.IterBeginBodies(); ibody != msystem.IterEndBodies(); ++ibody, ++i)
+	{
+		(*ibody)->SetPos(pos[i]);
+		(*ibody)->SetRot(rot[i]);
+		(*ibody)->SetPos_dt(pos_dt[i]);
+		(*ibody)->SetWvel_loc(wvel[i]);
+	}
+	msystem.SetChTime(time);
+	msystem.Update();
+	return true;
+}
+
+
+// Batched scene node for a class of identical bricks. Irrlicht 1.x has no
+// hardware instancing and binding one node per body costs one scene node, one
+// culling test and one draw call per brick. Here all the bricks of the same
+// size are one node: each frame their boxes are transformed on the CPU into a
+// single streamed mesh buffer (split in chunks, as indices are 16 bit), which
+// is drawn with one draw call per chunk.
+
+class BrickBatchSceneNode : public scene::ISceneNode
+{
+public:
+		/// Create the node for bricks of the given size (full lengths on x, y, z),
+		/// as a child of the root node of the scene manager.
+	BrickBatchSceneNode(scene::ISceneManager* mgr, ChVector<> msize, video::ITexture* mtexture)
+		: scene::ISceneNode(mgr->getRootSceneNode(), mgr, -1), half_size(msize * 0.5), filled_time(-1)
+	{
+		material.Lighting = true;
+		material.BackfaceCulling = false;	// no assumption on the winding, Chrono is right-handed
+		material.setTexture(0, mtexture);
+		box.reset(0, 0, 0);
+	}
+
+	~BrickBatchSceneNode()
+	{
+		for (size_t i = 0; i < chunks.size(); i++)
+			chunks[i]->drop();
+	}
+
+		/// Add a body: its box is drawn with the frame of the body at each frame.
+	void AddBody(ChSharedPtr<ChBody> mbody)
+	{
+		if (chunks.empty() || chunks.back()->getVertexCount() + 24 > BOXES_PER_CHUNK * 24)
+		{
+			scene::SMeshBuffer* mbuffer = new scene::SMeshBuffer;
+			mbuffer->setHardwareMappingHint(scene::EHM_STREAM, scene::EBT_VERTEX);
+			mbuffer->setHardwareMappingHint(scene::EHM_STATIC, scene::EBT_INDEX);
+			chunks.push_back(mbuffer);
+		}
+		scene::SMeshBuffer* mbuffer = chunks.back();
+		u16 first = (u16)mbuffer->Vertices.size();
+		for (int iv = 0; iv < 24; iv++)
+			mbuffer->Vertices.push_back(video::S3DVertex());
+		for (int iface = 0; iface < 6; iface++)
+		{
+			u16 v0 = first + 4 * iface;
+			mbuffer->Indices.push_back(v0);
+			mbuffer->Indices.push_back(v0 + 1);
+			mbuffer->Indices.push_back(v0 + 2);
+			mbuffer->Indices.push_back(v0);
+			mbuffer->Indices.push_back(v0 + 2);
+			mbuffer->Indices.push_back(v0 + 3);
+		}
+		mbuffer->setDirty(scene::EBT_INDEX);
+		bodies.push_back(mbody);
+		filled_time = -1;
+	}
+
+	int GetNbodies() { return (int)bodies.size(); }
+
+	virtual void OnRegisterSceneNode()
+	{
+		if (IsVisible)
+		{
+			Fill();		// the bounding box must be updated before the culling test
+			SceneManager->registerNodeForRendering(this);
+		}
+		ISceneNode::OnRegisterSceneNode();
+	}
+
+	virtual void render()
+	{
+		Fill();			// shadow passes may render the node before the scene manager
+		video::IVideoDriver* driver = SceneManager->getVideoDriver();
+		driver->setTransform(video::ETS_WORLD, core::IdentityMatrix);	// vertices are in absolute coordinates
+		driver->setMaterial(material);
+		for (size_t i = 0; i < chunks.size(); i++)
+			driver->drawMeshBuffer(chunks[i]);
+	}
+
+	virtual const core::aabbox3d<f32>& getBoundingBox() const { return box; }
+	virtual u32 getMaterialCount() const { return 1; }
+	virtual video::SMaterial& getMaterial(u32 i) { return material; }
+
+private:
+	enum { BOXES_PER_CHUNK = 2048 };	// 24 vertices each, within the 16 bit indices
+
+		/// Transform the boxes of all bodies in the mesh buffers, once per time step.
+	void Fill()
+	{
+		if (bodies.empty())
+			return;
+		double time = bodies[0]->GetSystem()->GetChTime();
+		if (time == filled_time)
+			return;
+		filled_time = time;
+
+		for (size_t ib = 0; ib < bodies.size(); ib++)
+		{
+			scene::SMeshBuffer* mbuffer = chunks[ib / BOXES_PER_CHUNK];
+			video::S3DVertex* vertex = &mbuffer->Vertices[(ib % BOXES_PER_CHUNK) * 24];
+			ChBody* mbody = bodies[ib].get_ptr();
+
+			// each face: axis a of the normal, sign, and the other two axes b, c
+			double half[3] = {half_size.x, half_size.y, half_size.z};
+			for (int iface = 0; iface < 6; iface++)
+			{
+				int a = iface / 2;
+				int b = (a + 1) % 3;
+				int c = (a + 2) % 3;
+				double sign = (iface % 2) ? -1.0 : 1.0;
+				double n_loc[3] = {0, 0, 0};
+				n_loc[a] = sign;
+				ChVector<> normal = mbody->GetRot().Rotate(ChVector<>(n_loc[0], n_loc[1], n_loc[2]));
+				for (int iv = 0; iv < 4; iv++)
+				{
+					double sb = (iv == 1 || iv == 2) ? 1.0 : -1.0;
+					double sc = (iv >= 2) ? 1.0 : -1.0;
+					double p_loc[3];
+					p_loc[a] = sign * half[a];
+					p_loc[b] = sb * half[b];
+					p_loc[c] = sc * half[c];
+					ChVector<> corner = mbody->GetPos() + mbody->GetRot().Rotate(ChVector<>(p_loc[0], p_loc[1], p_loc[2]));
+					vertex->Pos.set((f32)corner.x, (f32)corner.y, (f32)corner.z);
+					vertex->Normal.set((f32)normal.x, (f32)normal.y, (f32)normal.z);
+					vertex->Color = video::SColor(255, 255, 255, 255);
+					vertex->TCoords.set(0.5f * (f32)(sb + 1), 0.5f * (f32)(sc + 1));
+					vertex++;
+				}
+			}
+		}
+
+		for (size_t i = 0; i < chunks.size(); i++)
+		{
+			chunks[i]->recalculateBoundingBox();
+			chunks[i]->setDirty(scene::EBT_VERTEX);
+			if (i == 0)
+				box = chunks[i]->getBoundingBox();
+			else
+				box.addInternalBox(chunks[i]->getBoundingBox());
+		}
+	}
+
+	ChVector<> half_size;
+	std::vector<ChSharedPtr<ChBody> > bodies;
+	std::vector<scene::SMeshBuffer*> chunks;
+	video::SMaterial material;
+	core::aabbox3d<f32> box;
+	double filled_time;		// time of the system when the buffers were last filled
+};
+
+
+// Add to the viewer the batched node for a class of bricks, with the given
+// texture and optionally casting shadows. Returns 0 if there is no viewer
+// (headless runs), so that the bricks are simply not drawn.
+
+BrickBatchSceneNode* add_brick_batch(ChIrrApp* application, ChVector<> size, std::string texture_file, bool shadows)
+{
+	if (!application)
+		return 0;
+	video::ITexture* mtexture = application->GetVideoDriver()->getTexture(texture_file.c_str());
+	BrickBatchSceneNode* mbatch = new BrickBatchSceneNode(application->GetSceneManager(), size, mtexture);
+	mbatch->drop();		// owned by the scene graph from now on
+	if (shadows && application->GetEffects())
+		application->GetEffects()->addShadowToNode(mbatch);
+	return mbatch;
+}
+
+
 int main(int argc, char* argv[])
 {
+	// Run without the Irrlicht window (batch jobs) if launched with -headless.
+	// Use the monitor program to follow the results while the run goes on.
+	// A synthetic input motion can be chosen with -motion <type> and its
+	// parameters -ampl (peak acceleration, m/s^2), -freq (Hz), -t0 (onset, s),
+	// -seed, see create_synthetic_motion(); this way pulse sweeps need no input
+	// files.
+	bool headless = false;
+	std::string motion_type = "";
+	double motion_ampl = 1.0;
+	double motion_freq = 1.0;
+	double motion_t0 = 0.5;		// leave some time for the settlement of the blocks
+	unsigned int motion_seed = 1;
+
+	// Output files are written in -out_dir <dir> (default: the current
+	// directory), and the result cache is in -cache_dir <dir>. Parallel runs
+	// need separate output directories, and can share the cache.
+	std::string output_dir = "";
+	std::string result_cache_dir = "result_cache";
+
+	// Name of the shared-memory live results stream (-live <name>); by default
+	// it includes the process id, so that parallel runs have separate streams.
+	std::string live_name = LiveStreamDefaultName();
+
+	// Bricks cast shadows only if launched with -brick_shadows: each shadow
+	// caster is drawn once more per frame, in the shadow map.
+	bool brick_shadows = false;
+
+	// Contact impulses are warm started from the previous step (disable with
+	// -nowarmstart). With -save_settled <file> the state of the bodies at
+	// -settle_time is saved; a later run started with -load_settled <file>
+	// begins from that settled state and time, skipping the settlement.
+	bool warm_start = true;
+	std::string save_settled_file = "";
+	std::string load_settled_file = "";
+	double settle_time = -1;	// default: the start of the motion, -t0
+
+	for (int iarg = 1; iarg < argc; iarg++)
+	{
+		std::string arg(argv[iarg]);
+		bool has_value = (iarg + 1 < argc);
+		if (arg == "-headless")
+			headless = true;
+		else if (arg == "-motion" && has_value)
+			motion_type = argv[++iarg];
+		else if (arg == "-ampl" && has_value)
+			motion_ampl = atof(argv[++iarg]);
+		else if (arg == "-freq" && has_value)
+			motion_freq = atof(argv[++iarg]);
+		else if (arg == "-t0" && has_value)
+			motion_t0 = atof(argv[++iarg]);
+		else if (arg == "-seed" && has_value)
+			motion_seed = (unsigned int)atoi(argv[++iarg]);
+		else if (arg == "-live" && has_value)
+			live_name = argv[++iarg];
+		else if (arg == "-out_dir" && has_value)
+			output_dir = argv[++iarg];
+		else if (arg == "-cache_dir" && has_value)
+			result_cache_dir = argv[++iarg];
+		else if (arg == "-brick_shadows")
+			brick_shadows = true;
+		else if (arg == "-nowarmstart")
+			warm_start = false;
+		else if (arg == "-save_settled" && has_value)
+			save_settled_file = argv[++iarg];
+		else if (arg == "-load_settled" && has_value)
+			load_settled_file = argv[++iarg];
+		else if (arg == "-settle_time" && has_value)
+			settle_time = atof(argv[++iarg]);
+		else
+			GetLog() << "Unknown option " << arg.c_str() << "\n";
+	}
+
+	double t_end = 7; // exit simulation at this time
+	double timestep = 0.0001;
+
+	if (output_dir != "")
+		make_directory(output_dir);
+
+	// highest frequency in the synthetic motion: it must be resolved by the
+	// time step, with at least 20 steps per period
+	double motion_top_freq = (motion_type == "sweep") ? 10 * motion_freq : motion_freq;
+	if (motion_type != "" && motion_freq <= 0)
+	{
+		GetLog() << "Invalid -freq " << motion_freq << ": it must be positive\n";
+		return 1;
+	}
+	if (motion_type != "" && motion_type != "stochastic" && motion_top_freq > 1.0 / (20 * timestep))
+	{
+		GetLog() << "Invalid -freq " << motion_freq << ": the motion goes up to " << motion_top_freq
+				 << " Hz, the time step " << timestep << " s resolves up to " << 1.0 / (20 * timestep) << " Hz\n";
+		return 1;
+	}
+	if (motion_type != "" && (motion_t0 < 0 || motion_t0 >= t_end))
+	{
+		GetLog() << "Invalid -t0 " << motion_t0 << ": the motion must start between 0 and t_end = " << t_end << " s\n";
+		return 1;
+	}
+
 	// Create a ChronoENGINE physical system
 	ChSystem mphysicalSystem;
 
-	// Create the Irrlicht visualization (open the Irrlicht device, 
-	// bind a simple user interface, etc. etc.)
-	ChIrrApp application(&mphysicalSystem, L"Collisions between objects",core::dimension2d<u32>(800,600),false); //screen dimensions
+	ChIrrApp* application = 0;
 
-	// Easy shortcuts to add camera, lights, logo and sky in Irrlicht scene:
-	application.AddTypicalLogo();
-	application.AddTypicalSky();
-	application.AddTypicalLights();
-	application.AddTypicalCamera(core::vector3df(-1,1,-4), core::vector3df(0,3,3));		//to change the position of camera
-	application.AddLightWithShadow(vector3df(1,25,-5), vector3df(0,0,0), 35, 0.2,35, 55, 512, video::SColorf(1,1,1));
+	if (!headless)
+	{
+		// Create the Irrlicht visualization (open the Irrlicht device, 
+		// bind a simple user interface, etc. etc.)
+		application = new ChIrrApp(&mphysicalSystem, L"Collisions between objects",core::dimension2d<u32>(800,600),false); //screen dimensions
+
+		// Easy shortcuts to add camera, lights, logo and sky in Irrlicht scene:
+		application->AddTypicalLogo();
+		application->AddTypicalSky();
+		application->AddTypicalLights();
+		application->AddTypicalCamera(core::vector3df(-1,1,-4), core::vector3df(0,3,3));		//to change the position of camera
+		application->AddLightWithShadow(vector3df(1,25,-5), vector3df(0,0,0), 35, 0.2,35, 55, 512, video::SColorf(1,1,1));
+	}
  
 	// Create a shared material surface used by columns etc.
 	ChSharedPtr<ChMaterialSurface> mmat(new ChMaterialSurface);
@@ -114,6 +1507,17 @@ int main(int argc, char* argv[])
 //	mmat->SetRestitution(0.958f);
 
 
+	// Viewer settings for large scenes. Bricks are not bound to Irrlicht one by
+	// one: each class of identical bricks is drawn by one batched node, see
+	// BrickBatchSceneNode. Shadows can be switched per body class, as each shadow
+	// caster is drawn again in the shadow map; brick shadows are off unless the
+	// program is launched with -brick_shadows.
+	bool shadows_ground = true;
+	bool shadows_bricks = brick_shadows;
+
+	std::string brick_texture_file = GetChronoDataFile("whiteconcrete.jpg");
+
+
 	// Create all the rigid bodies.
 
 	// Create a floor that is fixed (that is used also to represent the aboslute reference)
@@ -155,8 +1559,15 @@ int main(int argc, char* argv[])
 //	double ampl_factor = 1; // use lower or greater to scale the earthquake.
 //	bool   use_barrier = false; // if true, the Barrier data files are used, otherwise the No_Barrier datafiles are used
 
-	// Define the horizontal motion, on x:
-	ChFunction_Sine* mmotion_x = new ChFunction_Sine(0, 0, 0); // phase freq ampl, carachteristics of input motion
+	// Define the horizontal motion, on x: a synthetic motion if chosen with -motion,
+	// otherwise the sine
+	ChFunction* mmotion_x = 0;
+	if (motion_type != "")
+		mmotion_x = create_synthetic_motion(motion_type, motion_ampl, motion_freq, motion_t0, t_end - motion_t0, motion_seed);
+	if (motion_type != "" && !mmotion_x)
+		GetLog() << "Unknown motion type " << motion_type.c_str() << "\n";
+	if (!mmotion_x)
+		mmotion_x = new ChFunction_Sine(0, 0, 0); // phase freq ampl, carachteristics of input motion
 	linkEarthquake->SetMotion_X(mmotion_x);
 
 //	ChFunction* mmotion_x    = create_motion("Accelerogrammi/input_trilite.txt", time_offset, ampl_factor);
@@ -203,6 +1614,61 @@ int main(int argc, char* argv[])
 	mphysicalSystem.Add(linkEarthquake);
 
 
+	// Intensity measures and elastic response spectra of the input motion.
+	// If a record file is given (accelerations, same format of create_motion), it is
+	// used; otherwise the acceleration of the table motion function is sampled.
+
+	std::string im_record_file = ""; // e.g. "Time history 10x0.50 Foam (d=6 m)/Barrier_Ah.txt"
+	double im_record_factor = 1.0;	 // scale to m/s^2
+	double im_dt = 0.001;
+	if (motion_type != "" && motion_type != "stochastic")
+		im_dt = ChMin(im_dt, 1.0 / (20 * motion_top_freq));	// no aliasing of the synthetic motion
+
+	std::vector<double> im_acc;
+	if (im_record_file != "")
+	{
+		load_record(im_record_file, im_dt, im_acc, im_record_factor);
+	}
+	else
+	{
+		for (double t = 0; t <= t_end; t += im_dt)
+			im_acc.push_back(mmotion_x->Get_y_dxdx(t));
+	}
+
+	std::vector<double> spectrum_periods;
+	std::vector<double> spectrum_dampings;
+	int n_periods = 200;
+	for (int ip = 0; ip < n_periods; ip++)
+		spectrum_periods.push_back(0.02 * pow(5.0/0.02, (double)ip/(n_periods-1))); // log spaced, 0.02..5 s
+	spectrum_dampings.push_back(0.0);
+	spectrum_dampings.push_back(0.02);
+	spectrum_dampings.push_back(0.05);
+	spectrum_dampings.push_back(0.10);
+	spectrum_dampings.push_back(0.20);
+
+	std::vector<double> spectrum_Sd, spectrum_PSa, spectrum_Sa;
+	compute_response_spectra(im_acc, im_dt, spectrum_periods, spectrum_dampings, spectrum_Sd, spectrum_PSa, spectrum_Sa);
+
+	IntensityMeasures input_im;
+	compute_intensity_measures(im_acc, im_dt, input_im);
+	for (size_t id = 0; id < spectrum_dampings.size(); id++)
+		if (fabs(spectrum_dampings[id] - 0.05) < 1e-9)
+			input_im.SI = compute_spectrum_intensity(spectrum_periods, &spectrum_PSa[id*n_periods]);
+
+	ChStreamOutAsciiFile data_spectrum(output_path(output_dir, "data_spectrum.txt").c_str());
+	data_spectrum << "# T[s], then PSa[m/s^2] for damping";
+	for (size_t id = 0; id < spectrum_dampings.size(); id++)
+		data_spectrum << " " << spectrum_dampings[id];
+	data_spectrum << "\n";
+	for (int ip = 0; ip < n_periods; ip++)
+	{
+		data_spectrum << spectrum_periods[ip];
+		for (size_t id = 0; id < spectrum_dampings.size(); id++)
+			data_spectrum << " " << spectrum_PSa[id*n_periods + ip];
+		data_spectrum << "\n";
+	}
+
+
 	// Pointers to some objects that will be plotted, for future use.
 	ChSharedPtr<ChBody> plot_brick_1;
 	ChSharedPtr<ChBody> plot_brick_3;
@@ -238,6 +1704,8 @@ int main(int argc, char* argv[])
 		double dimy = 1;
 		double dimz = 0.502;
 
+		BrickBatchSceneNode* brick_batch = add_brick_batch(application, ChVector<>(dimx, dimy, dimz), brick_texture_file, shadows_bricks);
+
 
 		
 
@@ -258,10 +1726,9 @@ int main(int argc, char* argv[])
 
 		mphysicalSystem.Add(mattone1);
 
-		//create a texture for the mattone1
-		ChSharedPtr<ChTexture> mtexturemattone1(new ChTexture());
-		mtexturemattone1->SetTextureFilename(GetChronoDataFile("whiteconcrete.jpg"));
-		mattone1->AddAsset(mtexturemattone1);
+		//drawn by the batched node of its class
+		if (brick_batch)
+			brick_batch->AddBody(mattone1);
 
 
 		//to create mattone2
@@ -297,6 +1764,8 @@ int main(int argc, char* argv[])
 		double dimy = 1;
 		double dimz = 0.502;
 
+		BrickBatchSceneNode* brick_batch = add_brick_batch(application, ChVector<>(dimx, dimy, dimz), brick_texture_file, shadows_bricks);
+
 	ChSharedPtr<ChBodyEasyBox> mattone2(new ChBodyEasyBox(
 			dimx, dimy , dimz , // x y z sizes
 			density,
@@ -309,10 +1778,9 @@ int main(int argc, char* argv[])
 		
 		mphysicalSystem.Add(mattone2);
 
-		//create a texture for the mattone2
-		ChSharedPtr<ChTexture> mtexturemattone2(new ChTexture());
-		mtexturemattone2->SetTextureFilename(GetChronoDataFile("whiteconcrete.jpg"));
-		mattone2->AddAsset(mtexturemattone2);
+		//drawn by the batched node of its class
+		if (brick_batch)
+			brick_batch->AddBody(mattone2);
 
 
 	for (int ai = 0; ai < 8; ai++)  // N. of walls
@@ -330,10 +1798,9 @@ int main(int argc, char* argv[])
 		
 		mphysicalSystem.Add(mattone1);
 
-		//create a texture for the mattone1
-		ChSharedPtr<ChTexture> mtexturemattone1(new ChTexture());
-		mtexturemattone1->SetTextureFilename(GetChronoDataFile("whiteconcrete.jpg"));
-		mattone1->AddAsset(mtexturemattone1);
+		//drawn by the batched node of its class
+		if (brick_batch)
+			brick_batch->AddBody(mattone1);
 
 			if (ai == 7)
 		{
@@ -364,6 +1831,8 @@ int main(int argc, char* argv[])
 		double dimy = 0.8;
 		double dimz = 0.65;
 
+		BrickBatchSceneNode* column_batch = add_brick_batch(application, ChVector<>(dimx, dimy, dimz), brick_texture_file, shadows_bricks);
+
 		//colonna1
 
 	ChSharedPtr<ChBodyEasyBox> colonna1(new ChBodyEasyBox(
@@ -380,10 +1849,9 @@ int main(int argc, char* argv[])
 		plot_brick_7 = colonna1;
 		mphysicalSystem.Add(colonna1);
 
-		//create a texture for the colonna1
-		ChSharedPtr<ChTexture> mtexturecolonna1(new ChTexture());
-		mtexturecolonna1->SetTextureFilename(GetChronoDataFile("whiteconcrete.jpg"));
-		colonna1->AddAsset(mtexturecolonna1);
+		//drawn by the batched node of its class
+		if (column_batch)
+			column_batch->AddBody(colonna1);
 
 
 		//colonna2
@@ -402,10 +1870,9 @@ ChSharedPtr<ChBodyEasyBox> colonna2(new ChBodyEasyBox(
 		plot_brick_10 = colonna2;
 		mphysicalSystem.Add(colonna2);
 
-		//create a texture for the colonna2
-		ChSharedPtr<ChTexture> mtexturecolonna2(new ChTexture());
-		mtexturecolonna2->SetTextureFilename(GetChronoDataFile("whiteconcrete.jpg"));
-		colonna2->AddAsset(mtexturecolonna2);
+		//drawn by the batched node of its class
+		if (column_batch)
+			column_batch->AddBody(colonna2);
 
 		//TRAVE
 
@@ -413,6 +1880,8 @@ ChSharedPtr<ChBodyEasyBox> colonna2(new ChBodyEasyBox(
 		double travey = 0.15 ;
 		double travez = 0.65 ;
 
+		BrickBatchSceneNode* beam_batch = add_brick_batch(application, ChVector<>(travex, travey, travez), brick_texture_file, shadows_bricks);
+
      ChSharedPtr<ChBodyEasyBox> trave(new ChBodyEasyBox(
 			travex, travey , travez, // x y z sizes
 			density,
@@ -427,26 +1896,31 @@ ChSharedPtr<ChBodyEasyBox> colonna2(new ChBodyEasyBox(
 		plot_brick_13 = trave;
 		mphysicalSystem.Add(trave);
 
-		//create a texture for the trave
-		ChSharedPtr<ChTexture> mtexturetrave(new ChTexture());
-		mtexturetrave->SetTextureFilename(GetChronoDataFile("whiteconcrete.jpg"));
-		trave->AddAsset(mtexturetrave);
+		//drawn by the batched node of its class
+		if (beam_batch)
+			beam_batch->AddBody(trave);
 
 //++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
 */
 
 
-	// Use this function for adding a ChIrrNodeAsset to all items
-	// Otherwise use application.AssetBind(myitem); on a per-item basis.
-	application.AssetBindAll();
-
-	// Use this function for 'converting' assets into Irrlicht meshes 
-	application.AssetUpdateAll();
-
-	// This is to enable shadow maps (shadow casting with soft shadows) in Irrlicht
-	// for all objects (or use application.AddShadow(..) for enable shadow on a per-item basis)
+	// Bind the ground items to Irrlicht on a per-item basis, instead of
+	// application.AssetBindAll(), AssetUpdateAll() and AddShadowAll(): the bricks
+	// are already in their batched nodes.
+	if (application)
+	{
+		application->AssetBind(floorBody);
+		application->AssetUpdate(floorBody);
+		application->AssetBind(tableBody);
+		application->AssetUpdate(tableBody);
 
-	application.AddShadowAll();
+		// This is to enable shadow maps (shadow casting with soft shadows) in Irrlicht
+		if (shadows_ground)
+		{
+			application->AddShadow(floorBody);
+			application->AddShadow(tableBody);
+		}
+	}
 
 
 	// Modify some setting of the physical system for the simulation, if you want
@@ -463,6 +1937,17 @@ ChSharedPtr<ChBodyEasyBox> colonna2(new ChBodyEasyBox(
 //	mphysicalSystem.SetLcpSolverType(ChSystem::LCP_SIMPLEX);
 	mphysicalSystem.SetIterLCPmaxItersSpeed(80);
 	mphysicalSystem.SetIterLCPmaxItersStab(5);
+
+	// Start the iterative solver from the contact impulses of the previous step.
+	// Contacts are persistent between steps (the collision engine keeps them in
+	// its contact manifolds, with their reactions cached), so if they change
+	// little from step to step the solver converges in fewer iterations.
+	mphysicalSystem.SetIterLCPwarmStarting(warm_start);
+
+	// Record the iterations done by the speed solver, for the solver statistics.
+	ChLcpIterativeSolver* lcp_solver = dynamic_cast<ChLcpIterativeSolver*>(mphysicalSystem.GetLcpSolverSpeed());
+	if (lcp_solver)
+		lcp_solver->SetRecordViolation(true);
 //	mphysicalSystem.SetMaxPenetrationRecoverySpeed(0.8);
 //	mphysicalSystem.SetMinBounceSpeed(0.01);
 	
@@ -476,56 +1961,250 @@ ChSharedPtr<ChBodyEasyBox> colonna2(new ChBodyEasyBox(
 
 	//mphysicalSystem.SetUseSleeping(true);
 
-	application.SetStepManage(true);
-	application.SetTimestep(0.0001);
-	application.SetTryRealtime(false);
+	if (application)
+	{
+		application->SetStepManage(true);
+		application->SetTimestep(timestep);
+		application->SetTryRealtime(false);
+	}
+
+
+	// Start from the settled state of a reference run, if given. Impulses can not
+	// be restored: they are warm started again from the second step on.
+	if (load_settled_file != "" && !load_system_state(mphysicalSystem, load_settled_file, motion_t0))
+	{
+		if (application)
+			delete application;
+		return 1;
+	}
+
+	// By default the state is saved at the onset of the motion, -t0: the
+	// synthetic motions are at rest before it.
+	if (settle_time < 0)
+		settle_time = motion_t0;
+	bool settled_saved = false;
+
+
+	// Output settings: results are saved each save_every steps; contact forces
+	// and energies are recorded only if record_contacts.
+	int save_every = 10;
+	bool record_contacts = true;
+
+	// Output files of the run. The streams are opened with these names, in the
+	// output directory, and the same list is stored in (and restored from) the
+	// result cache.
+	enum { OUT_EARTHQUAKE_X, OUT_TABLE, OUT_BRICK_1, OUT_BRICK_3, OUT_CONTACTS, OUT_ENERGY, OUT_SOLVER, OUT_SUMMARY, N_OUTPUT_FILES };
+	const char* output_files[N_OUTPUT_FILES] = {"data_earthquake_x.txt", "data_table.txt", "data_brick_1.txt", "data_brick_3.txt",
+												"data_contacts.txt", "data_energy.txt", "data_solver.txt", "data_summary.txt"};
+	ChStreamOutAsciiFile* output_streams[N_OUTPUT_FILES];
+
+
+	// Result cache, used by default in headless (batch) runs. The key describes
+	// the scene, the materials, the solver, the timestep, the output settings,
+	// the motions of the link on x, y, z (as applied, so including record,
+	// amplitude and offset) and the contents of the record file.
+
+	bool use_result_cache = headless && (save_settled_file == ""); // a hit would not save the settled state
+	std::string result_cache_path;
+
+	if (use_result_cache)
+	{
+		std::ostringstream key;
+		key << std::setprecision(17);
+		key << "Rozzi_earthquake result cache 2\n";
+		key << "build " << __DATE__ << " " << __TIME__;
+		std::string executable_contents;
+		if (read_executable_contents(executable_contents))
+			key << " executable " << std::hex << hash_fnv1a(executable_contents) << std::dec;
+		key << "\n";
+		describe_system(mphysicalSystem, key);
+		key << "timestep " << timestep << "\n";
+		key << "t_end " << t_end << "\n";
+		key << "save_every " << save_every << "\n";
+		key << "record_contacts " << record_contacts << "\n";
+		ChFunction* link_motions[3] = {linkEarthquake->GetMotion_X(), linkEarthquake->GetMotion_Y(), linkEarthquake->GetMotion_Z()};
+		for (int im = 0; im < 3; im++)
+		{
+			key << "motion_" << im;
+			for (double t = 0; t <= t_end; t += im_dt)
+				key << " " << link_motions[im]->Get_y(t);
+			key << "\n";
+		}
+		std::string record_contents;
+		if (im_record_file != "" && read_file_contents(GetChronoDataFile(im_record_file), record_contents))
+			key << "record " << im_record_file << " factor " << im_record_factor << "\n" << record_contents << "\n";
+
+		std::ostringstream hash;
+		hash << std::hex << std::setw(16) << std::setfill('0') << hash_fnv1a(key.str());
+		result_cache_path = result_cache_dir + "/" + hash.str();
+
+		// on a hit, the stored key must match too, to exclude hash collisions
+		std::string stored_key;
+		if (read_file_contents(result_cache_path + "/key.txt", stored_key) && stored_key == key.str())
+		{
+			bool hit = true;
+			for (int i = 0; i < N_OUTPUT_FILES; i++)
+				hit = hit && copy_file(result_cache_path + "/" + output_files[i], output_path(output_dir, output_files[i]));
+			if (hit)
+			{
+				GetLog() << "Results taken from cache " << result_cache_path.c_str() << "\n";
+				if (application)
+					delete application;
+				return 0;
+			}
+		}
+
+		make_directory(result_cache_dir);
+		make_directory(result_cache_path);
+		std::ofstream key_file((result_cache_path + "/key.txt.tmp").c_str(), std::ios::out | std::ios::binary);
+		key_file << key.str();
+	}
 
 
 	// Files for output data
-	ChStreamOutAsciiFile data_earthquake_x("data_earthquake_x.txt");
+	ChStreamOutAsciiFile data_earthquake_x(output_path(output_dir, output_files[OUT_EARTHQUAKE_X]).c_str());
 //	ChStreamOutAsciiFile data_earthquake_y("data_earthquake_y.txt");
 //	ChStreamOutAsciiFile data_earthquake_x_NB("data_earthquake_x_NB.txt");
 //	ChStreamOutAsciiFile data_earthquake_y_NB("data_earthquake_y_NB.txt");
-	ChStreamOutAsciiFile data_table("data_table.txt");
-	ChStreamOutAsciiFile data_brick_1("data_brick_1.txt");
-	ChStreamOutAsciiFile data_brick_3("data_brick_3.txt");
+	ChStreamOutAsciiFile data_table(output_path(output_dir, output_files[OUT_TABLE]).c_str());
+	ChStreamOutAsciiFile data_brick_1(output_path(output_dir, output_files[OUT_BRICK_1]).c_str());
+	ChStreamOutAsciiFile data_brick_3(output_path(output_dir, output_files[OUT_BRICK_3]).c_str());
+	output_streams[OUT_EARTHQUAKE_X] = &data_earthquake_x;
+	output_streams[OUT_TABLE] = &data_table;
+	output_streams[OUT_BRICK_1] = &data_brick_1;
+	output_streams[OUT_BRICK_3] = &data_brick_3;
 //	ChStreamOutAsciiFile data_brick_4("data_brick_4.txt");
 
 /*
-	ChStreamOutAsciiFile data_brick_5("data_brick_5.txt");
-	ChStreamOutAsciiFile data_brick_6("data_brick_6.txt");
-	ChStreamOutAsciiFile data_brick_7("data_brick_7.txt");
-	ChStreamOutAsciiFile data_brick_8("data_brick_8.txt");
-	ChStreamOutAsciiFile data_brick_9("data_brick_9.txt");
-	ChStreamOutAsciiFile data_brick_10("data_brick_10.txt");
-	ChStreamOutAsciiFile data_brick_11("data_brick_11.txt");
-	ChStreamOutAsciiFile data_brick_12("data_brick_12.txt");
-	ChStreamOutAsciiFile data_brick_13("data_brick_13.txt");
+	ChStreamOutAsciiFile data_brick_5(output_path(output_dir, "data_brick_5.txt").c_str());
+	ChStreamOutAsciiFile data_brick_6(output_path(output_dir, "data_brick_6.txt").c_str());
+	ChStreamOutAsciiFile data_brick_7(output_path(output_dir, "data_brick_7.txt").c_str());
+	ChStreamOutAsciiFile data_brick_8(output_path(output_dir, "data_brick_8.txt").c_str());
+	ChStreamOutAsciiFile data_brick_9(output_path(output_dir, "data_brick_9.txt").c_str());
+	ChStreamOutAsciiFile data_brick_10(output_path(output_dir, "data_brick_10.txt").c_str());
+	ChStreamOutAsciiFile data_brick_11(output_path(output_dir, "data_brick_11.txt").c_str());
+	ChStreamOutAsciiFile data_brick_12(output_path(output_dir, "data_brick_12.txt").c_str());
+	ChStreamOutAsciiFile data_brick_13(output_path(output_dir, "data_brick_13.txt").c_str());
 	*/
 
 //	ChStreamOutAsciiFile data_brick_2("data_brick_2.txt");
 
 
+	// Contact forces and energy balance. Each step the contacts are reduced on
+	// the tracked channels. The balance is done on the free bodies only: the
+	// table has a prescribed motion, and its huge mass would hide the energies
+	// of the blocks. The input work is the work done by the table on the free
+	// bodies through the contacts, -F_contacts_on_table * v_table. It uses the
+	// mean of the velocities before and after the step, as the dissipated energy
+	// does, so that for each table contact W_input - E_dissipated is the work on
+	// the block.
+	// The energy drift W_input - (E_mech - E_mech0) - E_dissipated should stay
+	// small: if not, the timestep is too large for this scene.
+
+	ContactRecorder contact_recorder;
+	int channel_brick_1 = contact_recorder.AddChannel(plot_brick_1.get_ptr());
+	int channel_brick_1_table = contact_recorder.AddChannel(plot_brick_1.get_ptr(), plot_table.get_ptr());
+	int channel_table = contact_recorder.AddChannel(plot_table.get_ptr());
+
+	double energy_kinetic = 0;
+	double energy_potential = 0;
+	compute_mechanical_energy(mphysicalSystem, energy_kinetic, energy_potential, plot_table.get_ptr());
+	double energy_mech_0 = energy_kinetic + energy_potential;
+	double work_input = 0;
+	double energy_drift = 0;
+	double max_energy_drift = 0;
+
+	ChStreamOutAsciiFile data_contacts(output_path(output_dir, output_files[OUT_CONTACTS]).c_str());
+	ChStreamOutAsciiFile data_energy(output_path(output_dir, output_files[OUT_ENERGY]).c_str());
+	output_streams[OUT_CONTACTS] = &data_contacts;
+	output_streams[OUT_ENERGY] = &data_energy;
+
+
+	// Solver statistics: iterations of the speed solver and time spent in it,
+	// per step, averaged between two saves and over the whole run.
+	ChStreamOutAsciiFile data_solver(output_path(output_dir, output_files[OUT_SOLVER]).c_str());
+	output_streams[OUT_SOLVER] = &data_solver;
+	int solver_iterations = 0;
+	int solver_steps = 0;
+	double solver_time = 0;
+	double total_solver_iterations = 0;
+	double total_solver_time = 0;
+	int total_solver_steps = 0;
+
+	ChTimer<double> wall_timer;
+	wall_timer.start();
+
+
+	// Live results stream: the saved channels are also published in a
+	// shared-memory ring buffer, read by the monitor program while running.
+	bool use_livestream = true;
+
+	const char* live_channel_names[] = {"earthquake_x", "table_x", "brick_1_x", "brick_1_z", "brick_3_rot", "energy_drift"};
+	double live_values[6];
+	LiveStream livestream;
+	if (use_livestream)
+	{
+		if (livestream.Create(live_name.c_str(), 6, live_channel_names))
+			GetLog() << "Live results stream: " << live_name.c_str() << "\n";
+		else
+			GetLog() << "Cannot create the live results stream " << live_name.c_str() << " (already in use?), running without it\n";
+	}
+
+
 	// 
 	// THE SOFT-REAL-TIME CYCLE
 	//
 	ChVector<> brick_initial_displacement;
+	double max_brick_rotation = 0;
 
 		int nstep = 0;
 
-	while (application.GetDevice()->run()){
+	while (headless || application->GetDevice()->run()){
          nstep++;
 
-		application.GetVideoDriver()->beginScene(true, true, SColor(255, 140, 161, 192));
+		if (record_contacts)
+			contact_recorder.StoreSpeeds(mphysicalSystem);
+
+		if (application)
+		{
+			application->GetVideoDriver()->beginScene(true, true, SColor(255, 140, 161, 192));
+
+			application->DrawAll();
+
+			application->DoStep();
+		}
+		else
+		{
+			mphysicalSystem.DoStepDynamics(timestep);
+		}
+
+		if (record_contacts)
+		{
+			contact_recorder.BeginStep();
+			mphysicalSystem.GetContactContainer()->ReportAllContacts(&contact_recorder);
+			contact_recorder.EndStep(timestep);
 
-		application.DrawAll();
+			work_input += -Vdot(contact_recorder.GetChannel(channel_table).F, contact_recorder.GetMeanSpeed(plot_table.get_ptr())) * timestep;
 
-		application.DoStep();
+			compute_mechanical_energy(mphysicalSystem, energy_kinetic, energy_potential, plot_table.get_ptr());
+			energy_drift = work_input - (energy_kinetic + energy_potential - energy_mech_0) - contact_recorder.GetDissipated();
+			max_energy_drift = ChMax(max_energy_drift, fabs(energy_drift));
+		}
+
+		if (lcp_solver)
+		{
+			solver_iterations += (int)lcp_solver->GetViolationHistory().size();
+			solver_time += mphysicalSystem.GetTimerLcp();
+			solver_steps++;
+		}
 
 		// save data for plotting
 		double time = mphysicalSystem.GetChTime();
 
-		if((nstep % 10) == 0)  // save each...
+		if (save_settled_file != "" && !settled_saved && time >= settle_time)
+			settled_saved = save_system_state(mphysicalSystem, save_settled_file);
+
+		if((nstep % save_every) == 0)  // save each...
 		{
 
 /*		if (time <1.5)
@@ -590,6 +2269,8 @@ ChSharedPtr<ChBodyEasyBox> colonna2(new ChBodyEasyBox(
 //						 << rel_motion_3.GetRotAxis().z << " "  
              << rel_motion_3.GetRotAngle()*rel_motion_3.GetRotAxis().z*180/3.14159 << "\n";
 
+			max_brick_rotation = ChMax(max_brick_rotation, fabs(rel_motion_3.GetRotAngle()*rel_motion_3.GetRotAxis().z*180/3.14159));
+
 
 
 /*						ChFrameMoving<> rel_motion_4;
@@ -712,97 +2393,131 @@ ChSharedPtr<ChBodyEasyBox> colonna2(new ChBodyEasyBox(
 				<< rel_motion_2.GetPos_dtdt().y << " "
 				<< rel_motion_2.GetPos_dtdt().z << "\n";
 */			
+			if (record_contacts)
+			{
+				// for each channel: n.contacts, Fn, Ft, normal impulse, tangential impulse, peak Fn, friction work
+				data_contacts << time;
+				for (int ic = 0; ic < contact_recorder.GetNchannels(); ic++)
+				{
+					ContactRecorder::Channel& mchannel = contact_recorder.GetChannel(ic);
+					data_contacts << " " << mchannel.n_contacts
+								  << " " << mchannel.Fn
+								  << " " << mchannel.Ft
+								  << " " << mchannel.impulse_n
+								  << " " << mchannel.impulse_t
+								  << " " << mchannel.Fn_peak
+								  << " " << mchannel.friction_work;
+				}
+				data_contacts << "\n";
+				contact_recorder.ResetOutput();
+
+				// time, kinetic, potential, input work, dissipated, of which by friction, drift
+				data_energy << time << " "
+							<< energy_kinetic << " "
+							<< energy_potential << " "
+							<< work_input << " "
+							<< contact_recorder.GetDissipated() << " "
+							<< contact_recorder.GetFrictionWork() << " "
+							<< energy_drift << "\n";
+			}
+
+			if (livestream.IsOpen())
+			{
+				live_values[0] = mmotion_x->Get_y(time);
+				live_values[1] = plot_table->GetPos().x;
+				live_values[2] = rel_motion.GetPos().x;
+				live_values[3] = rel_motion.GetPos().z;
+				live_values[4] = rel_motion_3.GetRotAngle()*rel_motion_3.GetRotAxis().z*180/3.14159;
+				live_values[5] = energy_drift;
+				livestream.Push(time, live_values);
+			}
+
+			if (solver_steps > 0)
+			{
+				data_solver << time << " "
+							<< (double)solver_iterations / solver_steps << " "	// mean iterations per step
+							<< solver_time / solver_steps << "\n";				// mean solver time per step [s]
+				total_solver_iterations += solver_iterations;
+				total_solver_time += solver_time;
+				total_solver_steps += solver_steps;
+				solver_iterations = 0;
+				solver_time = 0;
+				solver_steps = 0;
+			}
+
 			// end plotting data logout
 		}
 	//	}
 
-		application.GetVideoDriver()->endScene();
+		if (application)
+			application->GetVideoDriver()->endScene();
 
 		// Exit simulation if time greater than ..
-		if (mphysicalSystem.GetChTime() > 7) 
+		if (mphysicalSystem.GetChTime() > t_end) 
 			break;
 	}
 
 
-	// optional: automate the plotting launching GNUplot with a commandfile
-
-	/*bool use_gnuplot = true;
-
-	if (use_gnuplot)
-	{
-		ChStreamOutAsciiFile gnuplot_command("__data.gpl");
-		gnuplot_command << "set term wxt 0 \n";
-		gnuplot_command << "plot \"data_earthquake_x.dat\" using 1:2 with lines title \"x, barrier\" ,";
-		gnuplot_command << "     \"data_earthquake_x_NB.dat\" using 1:2 with lines  title \"x, no barrier\" ,";
-		gnuplot_command << "     \"data_earthquake_y.dat\" using 1:2 with lines title \"y, barrier\" ,";
-		gnuplot_command << "     \"data_earthquake_y_NB.dat\" using 1:2 with lines  title \"y, no barrier\" ,";
-		gnuplot_command << "     \"data_table.dat\" using 1:2 every 10 pt 7 ps 0.2  title \"x, table\" ,";
-		gnuplot_command << "     \"data_table.dat\" using 1:3 every 10 pt 7 ps 0.2  title \"y, table\" \n";
-		gnuplot_command << "set xlabel \"Time (s)\" \n";
-		gnuplot_command << "set ylabel \"x (m)\" \n";
-		gnuplot_command << "set grid \n";
-				
-		gnuplot_command << "set term wxt 1 \n";
-		gnuplot_command << "plot \"data_earthquake_x.dat\" using 1:3 with lines title \"Vx, barrier\" ,";
-		gnuplot_command << "     \"data_earthquake_x_NB.dat\" using 1:3 with lines  title \"Vx, no barrier\" ,";
-		gnuplot_command << "     \"data_table.dat\" using 1:5 every 5  pt 7 ps 0.2 title \"Vx, table\"  \n";
-		gnuplot_command << "set xlabel \"Time (s)\" \n";
-		gnuplot_command << "set ylabel \"v_x (m/s)\" \n";
-		gnuplot_command << "set grid \n";
-
-		gnuplot_command << "set term wxt 2 \n";
-		gnuplot_command << "plot \"data_earthquake_y.dat\" using 1:3 with lines title \"Vy, barrier\" ,";
-		gnuplot_command << "     \"data_earthquake_y_NB.dat\" using 1:3 with lines  title \"Vy, no barrier\" ,";
-		gnuplot_command << "     \"data_table.dat\" using 1:6 every 5  pt 7 ps 0.2 title \"Vy, table\" \n";
-		gnuplot_command << "set xlabel \"Time (s)\" \n";
-		gnuplot_command << "set ylabel \"v_x (m/s)\" \n";
-		gnuplot_command << "set grid \n";
-
-		gnuplot_command << "set term wxt 3 \n";
-		gnuplot_command << "plot \"data_earthquake_x.dat\" using 1:4 with lines title \"Ax, barrier\", ";
-		gnuplot_command << "     \"data_earthquake_x_NB.dat\" using 1:4 with lines title \"Ax, no barrier\" ,";
-		gnuplot_command << "     \"data_table.dat\" using 1:8 every 5  pt 7 ps 0.2 title \"Ax, table\" \n";
-		gnuplot_command << "set xlabel \"Time (s)\" \n";
-		gnuplot_command << "set ylabel \"a_x (m/s^2)\" \n";
-		gnuplot_command << "set grid \n";
-
-		gnuplot_command << "set term wxt 4 \n";
-		gnuplot_command << "plot \"data_earthquake_y.dat\" using 1:4 with lines title \"Ay, barrier\", ";
-		gnuplot_command << "     \"data_earthquake_y_NB.dat\" using 1:4 with lines title \"Ay, no barrier\" ,";
-		gnuplot_command << "     \"data_table.dat\" using 1:9 every 5  pt 7 ps 0.2 title \"Ay, table\"  \n";
-		gnuplot_command << "set xlabel \"Time (s)\" \n";
-		gnuplot_command << "set ylabel \"a_x (m/s^2)\" \n";
-		gnuplot_command << "set grid \n";
-
-		gnuplot_command << "set term wxt 5 \n";
-		gnuplot_command << "plot \"data_brick_1.dat\" using 1:2 with lines title \"x tip rel. displacement\", ";
-		gnuplot_command << "     \"data_brick_1.dat\" using 1:3 with lines title \"y tip rel. displacement\", ";
-		gnuplot_command << "     \"data_brick_1.dat\" using 1:4 with lines title \"z tip rel. displacement\"  \n";
-		gnuplot_command << "set xlabel \"Time (s)\" \n";
-		gnuplot_command << "set ylabel \"(m)\" \n";
-		gnuplot_command << "set grid \n";
-
-		gnuplot_command << "set term wxt 6 \n";
-		gnuplot_command << "plot \"data_brick_1.dat\" using 1:5 with lines title \"Vx tip rel. speed\", ";
-		gnuplot_command << "     \"data_brick_1.dat\" using 1:6 with lines title \"Vy tip rel. speed\", ";
-		gnuplot_command << "     \"data_brick_1.dat\" using 1:7 with lines title \"Vz tip rel. speed\"  \n";
-		gnuplot_command << "set xlabel \"Time (s)\" \n";
-		gnuplot_command << "set ylabel \"(m/s)\" \n";
-		gnuplot_command << "set grid \n";
-
-		gnuplot_command << "set term wxt 7 \n";
-		gnuplot_command << "plot \"data_brick_1.dat\" using 1:8 with lines title \"Ax body rel. acc.\", ";
-		gnuplot_command << "     \"data_brick_1.dat\" using 1:9 with lines title \"Ay body rel. acc.\", ";
-		gnuplot_command << "     \"data_brick_1.dat\" using 1:10 with lines title \"Az body rel. acc.\"  \n";
-		gnuplot_command << "set xlabel \"Time (s)\" \n";
-		gnuplot_command << "set ylabel \"(m/s^2)\" \n";
-		gnuplot_command << "set grid \n";
-
-		system ("start gnuplot \"__data.gpl\" -persist");
-	}
-
-
-	//system ("pause");*/
+	// Summary of the run: intensity measures of the input and peak response,
+	// one "key value" per line, for fragility and sweep post-processing.
+
+	ChStreamOutAsciiFile data_summary(output_path(output_dir, output_files[OUT_SUMMARY]).c_str());
+	output_streams[OUT_SUMMARY] = &data_summary;
+	data_summary << "t_end " << mphysicalSystem.GetChTime() << "\n";
+	data_summary << "PGA " << input_im.PGA << "\n";
+	data_summary << "PGV " << input_im.PGV << "\n";
+	data_summary << "PGD " << input_im.PGD << "\n";
+	data_summary << "arias " << input_im.arias << "\n";
+	data_summary << "CAV " << input_im.CAV << "\n";
+	data_summary << "a_rms " << input_im.a_rms << "\n";
+	data_summary << "t_5 " << input_im.t_5 << "\n";
+	data_summary << "t_95 " << input_im.t_95 << "\n";
+	data_summary << "D_5_95 " << input_im.D_5_95 << "\n";
+	data_summary << "SI " << input_im.SI << "\n";
+	data_summary << "max_brick_rotation " << max_brick_rotation << "\n";
+	wall_timer.stop();
+	data_summary << "warm_start " << warm_start << "\n";
+	data_summary << "wall_time " << wall_timer() << "\n";
+	if (total_solver_steps > 0)
+	{
+		data_summary << "solver_iterations_mean " << total_solver_iterations / total_solver_steps << "\n";
+		data_summary << "solver_time " << total_solver_time << "\n";
+	}
+	if (record_contacts)
+	{
+		double energy_scale = ChMax(ChMax(fabs(work_input), contact_recorder.GetDissipated()), 1e-12);
+		data_summary << "brick_table_friction_work " << contact_recorder.GetChannel(channel_brick_1_table).friction_work << "\n";
+		data_summary << "brick_friction_work " << contact_recorder.GetChannel(channel_brick_1).friction_work << "\n";
+		data_summary << "work_input " << work_input << "\n";
+		data_summary << "energy_dissipated " << contact_recorder.GetDissipated() << "\n";
+		data_summary << "energy_drift_max " << max_energy_drift << "\n";
+		data_summary << "energy_drift_rel " << max_energy_drift / energy_scale << "\n";
+	}
+
+
+	livestream.Close();
+
+
+	// Store the results in the cache, only if the run was completed. The key is
+	// written last, so that an interrupted store is never taken as a hit.
+
+	if (use_result_cache && mphysicalSystem.GetChTime() > t_end)
+	{
+		for (int i = 0; i < N_OUTPUT_FILES; i++)
+			output_streams[i]->Close();
+
+		bool stored = true;
+		for (int i = 0; i < N_OUTPUT_FILES; i++)
+			stored = stored && copy_file(output_path(output_dir, output_files[i]), result_cache_path + "/" + output_files[i]);
+		if (stored)
+			stored = copy_file(result_cache_path + "/key.txt.tmp", result_cache_path + "/key.txt");
+		remove((result_cache_path + "/key.txt.tmp").c_str());
+		if (stored)
+			GetLog() << "Results stored in cache " << result_cache_path.c_str() << "\n";
+	}
+
+	if (application)
+		delete application;
 
 	return 0;
 }
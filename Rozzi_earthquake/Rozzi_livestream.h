@@ -0,0 +1,304 @@
+//
+// Live results stream of the Rozzi_earthquake simulation.
+//
+// The simulation publishes a few channels (table motion, relative motion of the
+// tracked bricks, ...) in a ring buffer placed in a named shared-memory block.
+// A monitor process (see Rozzi_monitor.cpp) maps the same block and reads the
+// samples while the run is going on, without touching the disk.
+//
+// There is a single writer and any number of readers, and no locks: the writer
+// stores the sample in its slot, then increments the published counter. A reader
+// copies a slot and then checks that the writer did not wrap around over it in
+// the meantime; if so the sample is discarded. The writer never waits.
+//
+// The header stores the process id of the writer: if the writer crashes or is
+// killed, readers see that it is gone (IsWriterAlive) and can remove the stale
+// block, and a new writer can take over a stale block with the same name.
+//
+
+#ifndef ROZZI_LIVESTREAM_H
+#define ROZZI_LIVESTREAM_H
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+
+#if defined(_WIN32)
+	#ifndef NOMINMAX
+	#define NOMINMAX
+	#endif
+	#ifndef WIN32_LEAN_AND_MEAN
+	#define WIN32_LEAN_AND_MEAN
+	#endif
+	#include <windows.h>
+	#define LIVESTREAM_BARRIER() MemoryBarrier()
+#else
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <fcntl.h>
+	#include <unistd.h>
+	#include <signal.h>
+	#include <errno.h>
+	#define LIVESTREAM_BARRIER() __sync_synchronize()
+#endif
+
+
+#define LIVESTREAM_NAME_PREFIX "Rozzi_earthquake_live"
+#define LIVESTREAM_MAGIC 0x524C5632		// "RLV2", header with the writer pid
+#define LIVESTREAM_MAX_CHANNELS 16
+#define LIVESTREAM_NAME_LENGTH 32
+#define LIVESTREAM_CAPACITY 65536		// samples in the ring, power of two
+
+
+// Shared-memory names are global to the machine, so the default name includes
+// the process id: parallel runs never write in the same ring.
+
+inline std::string LiveStreamDefaultName()
+{
+	char mbuffer[64];
+#if defined(_WIN32)
+	sprintf(mbuffer, "%s_%lu", LIVESTREAM_NAME_PREFIX, (unsigned long)GetCurrentProcessId());
+#else
+	sprintf(mbuffer, "%s_%ld", LIVESTREAM_NAME_PREFIX, (long)getpid());
+#endif
+	return std::string(mbuffer);
+}
+
+
+struct LiveStreamHeader
+{
+	unsigned int magic;
+	unsigned int nchannels;
+	unsigned int capacity;
+	volatile unsigned int running;		// 0 when the writer has finished
+	volatile unsigned int published;	// number of samples published so far (wraps)
+	unsigned long writer_pid;			// process id of the writer
+	char channel_names[LIVESTREAM_MAX_CHANNELS][LIVESTREAM_NAME_LENGTH];
+};
+
+
+class LiveStream
+{
+public:
+	LiveStream() : header(0), samples(0), size(0), owner(false)
+	{
+	#if defined(_WIN32)
+		hmap = 0;
+	#else
+		fd = -1;
+	#endif
+	}
+
+	~LiveStream() { Close(); }
+
+		/// Create the shared-memory block, as writer. Channel 0 is always the time,
+		/// so each sample is made of nchannels+1 values. Fails if a block with
+		/// the same name already exists, as the ring allows a single writer.
+		/// A block left by a writer that died is removed and created again.
+	bool Create(const char* name, int nchannels, const char** channel_names)
+	{
+		if (nchannels > LIVESTREAM_MAX_CHANNELS)
+			nchannels = LIVESTREAM_MAX_CHANNELS;
+		if (!Map(name, true, nchannels))
+		{
+			LiveStream mstale;
+			if (!mstale.Open(name) || mstale.IsWriterAlive())
+				return false;
+			mstale.Remove();
+			if (!Map(name, true, nchannels))
+				return false;
+		}
+		owner = true;
+
+		header->magic = 0;
+		header->nchannels = nchannels;
+		header->capacity = LIVESTREAM_CAPACITY;
+		header->published = 0;
+		header->running = 1;
+	#if defined(_WIN32)
+		header->writer_pid = (unsigned long)GetCurrentProcessId();
+	#else
+		header->writer_pid = (unsigned long)getpid();
+	#endif
+		memset(header->channel_names, 0, sizeof(header->channel_names));
+		for (int i = 0; i < nchannels; i++)
+			strncpy(header->channel_names[i], channel_names[i], LIVESTREAM_NAME_LENGTH - 1);
+		LIVESTREAM_BARRIER();
+		header->magic = LIVESTREAM_MAGIC;
+		return true;
+	}
+
+		/// Attach to an existing shared-memory block, as reader.
+	bool Open(const char* name)
+	{
+		if (!Map(name, false, -1))
+			return false;
+		if (header->magic != LIVESTREAM_MAGIC || header->nchannels > LIVESTREAM_MAX_CHANNELS)
+		{
+			Close();
+			return false;
+		}
+		unsigned int nchannels = header->nchannels;
+		Close();
+		return Map(name, false, nchannels);
+	}
+
+		/// Remove the name of a stale block (the writer died without removing it),
+		/// then detach. Only for readers: a writer removes its block when closed.
+	void Remove()
+	{
+	#if !defined(_WIN32)
+		if (header)
+			shm_unlink(shm_name.c_str());
+	#endif
+		Close();
+	}
+
+	void Close()
+	{
+		if (!header)
+			return;
+		if (owner)
+		{
+			header->running = 0;
+			LIVESTREAM_BARRIER();
+		}
+	#if defined(_WIN32)
+		UnmapViewOfFile(header);
+		CloseHandle(hmap);
+		hmap = 0;
+	#else
+		munmap(header, size);
+		close(fd);
+		fd = -1;
+		if (owner)
+			shm_unlink(shm_name.c_str());
+	#endif
+		header = 0;
+		samples = 0;
+		owner = false;
+	}
+
+	bool IsOpen() { return header != 0; }
+	int GetNchannels() { return header->nchannels; }
+	const char* GetChannelName(int i) { return header->channel_names[i]; }
+	bool IsRunning() { return header->running != 0; }
+
+		/// False if the writer process does not exist any more, for example if it
+		/// crashed or was killed before clearing the running flag.
+	bool IsWriterAlive()
+	{
+	#if defined(_WIN32)
+		HANDLE hprocess = OpenProcess(SYNCHRONIZE, FALSE, (DWORD)header->writer_pid);
+		if (!hprocess)
+			return false;
+		bool alive = (WaitForSingleObject(hprocess, 0) == WAIT_TIMEOUT);
+		CloseHandle(hprocess);
+		return alive;
+	#else
+		return (kill((pid_t)header->writer_pid, 0) == 0 || errno == EPERM);
+	#endif
+	}
+	unsigned int GetPublished() { unsigned int n = header->published; LIVESTREAM_BARRIER(); return n; }
+
+		/// Publish a sample: the time and nchannels values. Never blocks.
+	void Push(double time, const double* values)
+	{
+		unsigned int n = header->published;
+		double* slot = samples + (size_t)(n & (LIVESTREAM_CAPACITY - 1)) * (header->nchannels + 1);
+		slot[0] = time;
+		memcpy(slot + 1, values, sizeof(double) * header->nchannels);
+		LIVESTREAM_BARRIER();
+		header->published = n + 1;
+	}
+
+		/// Copy the sample with the given sequence number in sample[] (nchannels+1 values).
+		/// Returns false if it is not published yet, or if it has been overwritten.
+	bool Read(unsigned int index, double* sample)
+	{
+		unsigned int n = GetPublished();
+		if ((unsigned int)(n - index) - 1 >= LIVESTREAM_CAPACITY)
+			return false;
+		double* slot = samples + (size_t)(index & (LIVESTREAM_CAPACITY - 1)) * (header->nchannels + 1);
+		memcpy(sample, slot, sizeof(double) * (header->nchannels + 1));
+		LIVESTREAM_BARRIER();
+		n = header->published;
+		return ((unsigned int)(n - index) < LIVESTREAM_CAPACITY);	// else the writer may be on this slot
+	}
+
+private:
+		/// Map the block, sized for nchannels (only the header if nchannels < 0).
+	bool Map(const char* name, bool create, int nchannels)
+	{
+		size = sizeof(LiveStreamHeader);
+		if (nchannels >= 0)
+			size += sizeof(double) * LIVESTREAM_CAPACITY * (nchannels + 1);
+	#if defined(_WIN32)
+		if (create)
+		{
+			hmap = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, (DWORD)size, name);
+			if (hmap && GetLastError() == ERROR_ALREADY_EXISTS)
+			{
+				CloseHandle(hmap);
+				hmap = 0;
+			}
+		}
+		else
+			hmap = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, name);
+		if (!hmap)
+			return false;
+		void* mem = MapViewOfFile(hmap, FILE_MAP_ALL_ACCESS, 0, 0, size);
+		if (!mem)
+		{
+			CloseHandle(hmap);
+			hmap = 0;
+			return false;
+		}
+	#else
+		shm_name = std::string("/") + name;
+		fd = shm_open(shm_name.c_str(), create ? (O_CREAT | O_EXCL | O_RDWR) : O_RDWR, 0600);
+		if (fd < 0)
+			return false;
+		if (create && ftruncate(fd, size) != 0)
+		{
+			close(fd);
+			fd = -1;
+			shm_unlink(shm_name.c_str());
+			return false;
+		}
+		// a reader may come between the shm_open and the ftruncate of the writer:
+		// accessing beyond the size of the object would raise SIGBUS
+		struct stat mstat;
+		if (!create && (fstat(fd, &mstat) != 0 || (size_t)mstat.st_size < size))
+		{
+			close(fd);
+			fd = -1;
+			return false;
+		}
+		void* mem = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (mem == MAP_FAILED)
+		{
+			close(fd);
+			fd = -1;
+			return false;
+		}
+	#endif
+		header = (LiveStreamHeader*)mem;
+		samples = (double*)((char*)mem + sizeof(LiveStreamHeader));
+		return true;
+	}
+
+	LiveStreamHeader* header;
+	double* samples;
+	size_t size;
+	bool owner;
+#if defined(_WIN32)
+	HANDLE hmap;
+#else
+	int fd;
+	std::string shm_name;
+#endif
+};
+
+
+#endif
@@ -0,0 +1,116 @@
+//
+// Monitor for the live results stream of Rozzi_earthquake.
+//
+// Attaches to the shared-memory ring buffer published by a running simulation
+// and prints the new samples on stdout, one line per sample: time and channel
+// values separated by spaces. The first line, starting with #, has the channel
+// names. The output can be piped into a live plotter, for example
+//
+//     monitor Rozzi_earthquake_live_1234 | feedgnuplot --stream --lines --domain
+//
+// Usage:  monitor <stream name> [-every N]
+//
+// The stream name is printed by the simulation at start; it can be chosen there
+// with the -live option. If the simulation crashes or is killed, the monitor
+// exits and removes the stream it left behind.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include "Rozzi_livestream.h"
+
+#if defined(_WIN32)
+	#define MONITOR_SLEEP_MS(ms) Sleep(ms)
+#else
+	#define MONITOR_SLEEP_MS(ms) usleep((ms) * 1000)
+#endif
+
+
+int main(int argc, char* argv[])
+{
+	std::string name = "";
+	unsigned int every = 1;		// print one sample each N
+
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg(argv[i]);
+		if (arg == "-every" && i + 1 < argc)
+			every = (unsigned int)atoi(argv[++i]);
+		else
+			name = arg;
+	}
+	if (every < 1)
+		every = 1;
+	if (name == "")
+	{
+		fprintf(stderr, "usage: monitor <stream name> [-every N]\n");
+		return 1;
+	}
+
+	LiveStream stream;
+
+	// wait for the simulation to create the stream
+	while (!stream.Open(name.c_str()))
+		MONITOR_SLEEP_MS(200);
+
+	int nchannels = stream.GetNchannels();
+	printf("# time");
+	for (int i = 0; i < nchannels; i++)
+		printf(" %s", stream.GetChannelName(i));
+	printf("\n");
+	fflush(stdout);
+
+	std::vector<double> sample(nchannels + 1);
+	// start from the oldest sample still in the ring
+	unsigned int next = stream.GetPublished();
+	next = (next > LIVESTREAM_CAPACITY) ? next - LIVESTREAM_CAPACITY : 0;
+	unsigned int lost = 0;
+
+	while (true)
+	{
+		bool running = stream.IsRunning();
+		bool crashed = running && !stream.IsWriterAlive();
+		if (crashed)
+			running = false;
+		unsigned int published = stream.GetPublished();
+
+		// if the reader fell behind a full ring, skip to the oldest sample still there
+		if ((unsigned int)(published - next) > LIVESTREAM_CAPACITY)
+		{
+			lost += (published - LIVESTREAM_CAPACITY) - next;
+			next = published - LIVESTREAM_CAPACITY;
+		}
+
+		for (; next != published; next++)
+		{
+			if (next % every)
+				continue;
+			if (!stream.Read(next, &sample[0]))
+			{
+				lost++;
+				continue;
+			}
+			printf("%g", sample[0]);
+			for (int i = 1; i <= nchannels; i++)
+				printf(" %g", sample[i]);
+			printf("\n");
+		}
+		fflush(stdout);
+
+		if (crashed)
+		{
+			fprintf(stderr, "monitor: the simulation ended without closing the stream, removing it\n");
+			stream.Remove();
+			break;
+		}
+		if (!running)
+			break;
+		MONITOR_SLEEP_MS(50);
+	}
+
+	if (lost)
+		fprintf(stderr, "monitor: %u samples lost, the reader was too slow\n", lost);
+
+	return 0;
+}